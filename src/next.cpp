@@ -1,8 +1,18 @@
 #include "next.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <stack>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <boost/fusion/algorithm.hpp>
 #include <boost/spirit/home/x3.hpp>
@@ -60,6 +70,10 @@ namespace client {
             _val(ctx) = std::shared_ptr<NextFunctor::Base>(new NextFunctor::DayOfWeek(_attr(ctx)));
         };
 
+        auto dayofmonth_f = [](auto& ctx){
+            _val(ctx) = std::shared_ptr<NextFunctor::Base>(new NextFunctor::DayOfMonth(_attr(ctx)));
+        };
+
         auto hour_f = [](auto& ctx){
             _val(ctx) = std::shared_ptr<NextFunctor::Base>(new NextFunctor::Hour(_attr(ctx)));
         };
@@ -105,6 +119,8 @@ namespace client {
         rule<class month, std::shared_ptr<NextFunctor::Base>> const month = "month";
         rule<class dayofweek, std::shared_ptr<NextFunctor::Base>> const dayofweek = "dayofweek";
 
+        rule<class dayofmonth, std::shared_ptr<NextFunctor::Base>> const dayofmonth = "dayofmonth";
+
         rule<class hour, std::shared_ptr<NextFunctor::Base>> const hour = "hour";
         rule<class minute, std::shared_ptr<NextFunctor::Base>> const minute = "minute";
         rule<class second, std::shared_ptr<NextFunctor::Base>> const second = "second";
@@ -120,13 +136,15 @@ namespace client {
         auto const month_def = months[month_f];
         auto const dayofweek_def = dayofweeks[dayofweek_f];
 
+        auto const dayofmonth_def = (int_ >> lit("d"))[dayofmonth_f];
+
         auto const hour_def = (int_ >> lit("H"))[hour_f];
         auto const minute_def = (int_ >> lit("M"))[minute_f];
         auto const second_def = (int_ >> lit("S"))[second_f];
 
         auto const hour_minute_def = (int_ >> lit(":") >> int_)[hm_f];
 
-        auto const cond_proxy_def = month | dayofweek | hour | minute | second | hour_minute | allof | firstof;
+        auto const cond_proxy_def = month | dayofweek | dayofmonth | hour | minute | second | hour_minute | allof | firstof;
         auto const cond_def = cond_proxy;
 
         auto const allof_def = (lit("(") >> (*blank) >> (cond_def % (*blank >> '&' >> *blank)) >> (*blank) >> lit(")"))[allof_f];
@@ -134,7 +152,7 @@ namespace client {
 
         #pragma GCC diagnostic push
         #pragma GCC diagnostic ignored  "-Wunused-parameter"
-        BOOST_SPIRIT_DEFINE(month, dayofweek, hour, minute, second, hour_minute, cond_proxy, cond, allof, firstof);
+        BOOST_SPIRIT_DEFINE(month, dayofweek, dayofmonth, hour, minute, second, hour_minute, cond_proxy, cond, allof, firstof);
         #pragma GCC diagnostic pop
     }
 }
@@ -156,10 +174,75 @@ namespace NextFunctor {
         if (!r){
             std::cout << "parsing failed at: '" << std::string(iter, end) << "'\n";
         }
+        else if (const Base* contradiction = result->contradiction()){
+            std::cout << "schedule '" << str << "' can never be satisfied: " << *contradiction << "\n";
+            result = nullptr;
+        }
 
         return result;
     }
 
+    std::shared_ptr<NextFunctor::Base> Base::compile(const std::string& str){
+        std::shared_ptr<NextFunctor::Base> tree(Base::parse(str));
+        if(!tree){
+            return tree;
+        }
+        return std::make_shared<Compiled>(*tree);
+    }
+
+    std::size_t Base::fill(ptime from, bool force_carry, const ptime& until, ptime* out, std::size_t n){
+        std::size_t i = 0;
+        for(; i < n; ++i){
+            ptime t = (*this)(from, force_carry);
+            if(t.is_special() || t >= until)
+                break;
+            out[i] = t;
+            from = t;
+            force_carry = true;
+        }
+        return i;
+    }
+
+    Occurrences Base::occurrences(const ptime& begin, const ptime& end){
+        return Occurrences(*this, begin, end, std::numeric_limits<std::size_t>::max());
+    }
+
+    Occurrences Base::occurrences(const ptime& from, std::size_t count){
+        return Occurrences(*this, from, boost::date_time::pos_infin, count);
+    }
+
+    constexpr std::size_t Occurrences::batch_size;
+
+    Occurrences::Occurrences(Base& schedule, const ptime& from, const ptime& until, std::size_t count):
+        schedule(schedule),
+        from(from),
+        force_carry(false),
+        until(until),
+        remaining(count),
+        buffer(),
+        position(0)
+    {
+        this->refill();
+    }
+
+    void Occurrences::advance(){
+        if(++this->position == this->buffer.size()){
+            this->refill();
+        }
+    }
+
+    void Occurrences::refill(){
+        std::size_t n = std::min(this->remaining, batch_size);
+        this->buffer.resize(n);
+        this->buffer.resize(this->schedule.fill(this->from, this->force_carry, this->until, this->buffer.data(), n));
+        this->remaining -= this->buffer.size();
+        this->position = 0;
+        if(!this->buffer.empty()){
+            this->from = this->buffer.back();
+            this->force_carry = true;
+        }
+    }
+
     using boost::gregorian::date;
     using boost::gregorian::days;
     using boost::gregorian::months;
@@ -170,140 +253,361 @@ namespace NextFunctor {
     using boost::posix_time::time_duration;
     using boost::posix_time::ptime;
 
-    template <typename T>
-    constexpr long mus();
+    namespace {
+        //index of the lowest set bit at or above `bit`, -1 if there is none
+        int next_bit(std::uint64_t mask, int bit){
+            if(bit >= 64)
+                return -1;
+            mask &= ~std::uint64_t(0) << bit;
+            return mask ? __builtin_ctzll(mask) : -1;
+        }
 
-    template <>
-    constexpr long mus<Second>(){
-        return 1e6;
-    }
+        //first second of the day at or after `second` whose hour, minute and second lie in the masks, -1 if none
+        long next_second_of_day(const Fields& f, long second){
+            int h = second / 3600;
+            int m = second / 60 % 60;
+            int s = second % 60;
+
+            while(h < 24){
+                int nh = next_bit(f.hours, h);
+                if(nh < 0)
+                    return -1;
+                if(nh != h){
+                    h = nh; m = 0; s = 0;
+                }
+                int nm = next_bit(f.minutes, m);
+                if(nm >= 0){
+                    if(nm != m){
+                        m = nm; s = 0;
+                    }
+                    int ns = next_bit(f.seconds, s);
+                    if(ns >= 0){
+                        return h * 3600l + m * 60l + ns;
+                    }
+                    if(++m < 60){
+                        s = 0;
+                        continue;
+                    }
+                }
+                ++h; m = 0; s = 0;
+            }
+            return -1;
+        }
 
-    template <>
-    constexpr long mus<Minute>(){
-        return mus<Second>() * 60;
+        //bit d - 1 for every day d of a month (0 based) whose day and weekday lie in the masks
+        std::uint32_t matching_days(const Fields& f, int year, int month){
+            if(!(f.months >> month & 1))
+                return 0;
+            int length = boost::gregorian::gregorian_calendar::end_of_month_day(year, month + 1);
+            int weekday = date(year, month + 1, 1).day_of_week();
+            std::uint32_t on_weekdays = 0;
+            for(int w = 0; w < 7; ++w){
+                if(f.weekdays >> ((weekday + w) % 7) & 1)
+                    on_weekdays |= 0x10204081u << w; //bits w, w + 7, w + 14, ...
+            }
+            return f.days & on_weekdays & ((std::uint32_t(1) << length) - 1);
+        }
     }
 
-    template <>
-    constexpr long mus<Hour>(){
-        return mus<Minute>() * 60;
+#ifdef NEXT_STATISTICS
+    thread_local Statistics statistics{0, 0};
+#endif
+
+    bool operator==(const Fields& f1, const Fields& f2){
+        return f1.months == f2.months && f1.days == f2.days && f1.weekdays == f2.weekdays
+            && f1.hours == f2.hours && f1.minutes == f2.minutes && f1.seconds == f2.seconds;
     }
 
-    template <typename T>
-    ptime ceil(ptime t, bool force_carry){
-        long rem = t.time_of_day().total_microseconds() % mus<T>();
-        if(!force_carry && rem == 0)
-            return t;
-        else
-            return t + microseconds(-rem) + microseconds(mus<T>());
+    bool Fields::contains(const ptime& t) const{
+        date d = t.date();
+        time_duration tod = t.time_of_day();
+        return (this->months >> (d.month() - 1) & 1)
+            && (this->days >> (d.day() - 1) & 1)
+            && (this->weekdays >> d.day_of_week() & 1)
+            && (this->hours >> tod.hours() & 1)
+            && (this->minutes >> tod.minutes() & 1)
+            && (this->seconds >> tod.seconds() & 1);
     }
 
-    template <>
-    ptime ceil<DayOfMonth>(ptime t, bool force_carry){
-        long rem = t.time_of_day().total_microseconds();
-        if(!force_carry && rem == 0)
-            return t;
-        else{
-            return t + microseconds(-rem) + days(1);
+    ptime Fields::next(const ptime& from) const{
+#ifdef NEXT_STATISTICS
+        ++statistics.solves;
+#endif
+        if(this->contains(from))
+            return from;
+
+        date d = from.date();
+        long first = next_second_of_day(*this, 0);
+        if(first < 0 || this->empty())
+            return boost::date_time::pos_infin;
+
+        //later on the same day
+        if((this->months >> (d.month() - 1) & 1) && (this->days >> (d.day() - 1) & 1) && (this->weekdays >> d.day_of_week() & 1)){
+            long second = next_second_of_day(*this, from.time_of_day().total_seconds() + 1);
+            if(second >= 0)
+                return ptime(d, boost::posix_time::seconds(second));
         }
-    }
 
-    template <>
-    ptime ceil<Month>(ptime t, bool force_carry){
-        if(!force_carry && t.time_of_day().total_microseconds() == 0 && t.date().day() == 1)
-            return t;
-        else{
-            date d = (t.date() - days(t.date().day() - 1)) + months(1);
-            return ptime(d, time_duration(0,0,0,0));
+        //on a later day: month by month, skipping months outside the mask. The
+        //calendar repeats after 400 years, so there is nothing to find beyond that.
+        int year = d.year();
+        int month = d.month() - 1;
+        int day = d.day();
+        for(int i = 0; i <= 400 * 12; ++i){
+#ifdef NEXT_STATISTICS
+            ++statistics.steps;
+#endif
+            int m = next_bit(this->months, month);
+            if(m < 0){
+                ++year; month = 0; day = 0;
+                continue;
+            }
+            if(m != month){
+                month = m; day = 0;
+            }
+
+            std::uint32_t candidates = matching_days(*this, year, month) & (~std::uint32_t(0) << day);
+            if(candidates){
+                return ptime(date(year, month + 1, __builtin_ctz(candidates) + 1), boost::posix_time::seconds(first));
+            }
+
+            if(++month == 12){
+                ++year; month = 0;
+            }
+            day = 0;
         }
+        return boost::date_time::pos_infin;
     }
 
-    ptime Month::operator()(const ptime& from, bool force_carry){
-        if(!force_carry && from.date().month() == this->month)
-            return from;
+    namespace {
+        //the first instant at or after the given ones in a term, for queries which
+        //mostly stay in the same month like those of fill. The days of the month
+        //matching the term are kept, so that only moving on to another month costs
+        //what Fields::next does for every query
+        class Cursor{
+        public:
+            explicit Cursor(const Fields& term):
+                term(term),
+                first(term.empty() ? -1 : next_second_of_day(term, 0)),
+                year(0),
+                month(-1),
+                days(0)
+            {}
+
+            ptime next(const ptime& from){
+#ifdef NEXT_STATISTICS
+                ++statistics.solves;
+#endif
+                if(this->first < 0)
+                    return boost::date_time::pos_infin;
+
+                date d = from.date();
+                date::ymd_type ymd = d.year_month_day();
+                this->load(ymd.year, ymd.month - 1);
+                int day = ymd.day;
+                if(this->days >> (day - 1) & 1){
+                    //at or later on the same day
+                    time_duration tod = from.time_of_day();
+                    if((this->term.hours >> tod.hours() & 1) && (this->term.minutes >> tod.minutes() & 1) && (this->term.seconds >> tod.seconds() & 1))
+                        return from;
+                    long second = next_second_of_day(this->term, tod.total_seconds() + 1);
+                    if(second >= 0)
+                        return ptime(d, boost::posix_time::seconds(second));
+                }
+
+                //on a later day of this month or a later one, within the 400 years the calendar repeats after
+                int year = ymd.year;
+                int month = ymd.month - 1;
+                for(int i = 0; i <= 400 * 12; ++i){
+                    std::uint32_t later = this->days & (~std::uint32_t(0) << day);
+                    if(later)
+                        return ptime(date(year, month + 1, __builtin_ctz(later) + 1), boost::posix_time::seconds(this->first));
+                    month = next_bit(this->term.months, month + 1);
+                    if(month < 0){
+                        ++year; month = next_bit(this->term.months, 0);
+                    }
+                    day = 0;
+                    this->load(year, month);
+                }
+                return boost::date_time::pos_infin;
+            }
 
-        ptime t = ceil<Month>(from, force_carry);
-        auto mon_diff = this->month - t.date().month();
-        if (mon_diff < 0) mon_diff += 12;
-        return t + months(mon_diff);
+        private:
+            void load(int year, int month){
+                if(year != this->year || month != this->month){
+#ifdef NEXT_STATISTICS
+                    ++statistics.steps;
+#endif
+                    this->year = year;
+                    this->month = month;
+                    this->days = matching_days(this->term, year, month);
+                }
+            }
+
+            const Fields& term;
+            long first; //second of the day of the first instant on a matching day
+            int year; //of the days kept
+            int month;
+            std::uint32_t days; //matching days of the month, bit d - 1 for day d
+        };
     }
 
-    ptime DayOfMonth::operator()(const ptime& from, bool force_carry){
-        if(!force_carry && from.date().day() == this->dayofmonth)
-            return from;
+    ptime Month::operator()(const ptime& from, bool force_carry){
+        return next(this->month, from, force_carry);
+    }
 
-        ptime t = ceil<DayOfMonth>(from, force_carry);
-        auto day_diff = this->dayofmonth - t.date().day();
-        if (day_diff < 0){
-            t = ceil<Month>(from, true);
-            day_diff = this->dayofmonth - 1;
-        }
-        return t + days(day_diff);
+    ptime DayOfMonth::operator()(const ptime& from, bool force_carry){
+        return next(this->dayofmonth, from, force_carry);
     }
 
     ptime DayOfWeek::operator()(const ptime& from, bool force_carry){
-        if(!force_carry && from.date().day_of_week() == this->dayofweek)
-            return from;
-
-        ptime t = ceil<DayOfMonth>(from, force_carry);
-        date d = t.date();
-        d = next_weekday(d, boost::gregorian::greg_weekday(this->dayofweek));
-        return ptime(d, time_duration(0,0,0,0));
+        return next(this->dayofweek, from, force_carry);
     }
 
     ptime Hour::operator()(const ptime& from, bool force_carry){
-        if(!force_carry && from.time_of_day().hours() == this->hour)
-            return from;
-        ptime t = ceil<Hour>(from, force_carry);
-        auto diff = mus<Hour>() * this->hour - t.time_of_day().total_microseconds();
-        if(diff < 0) diff += mus<Hour>() * 24;
-        return t + microseconds(diff);
+        return next(this->hour, from, force_carry);
     }
 
     ptime Minute::operator()(const ptime& from, bool force_carry){
-        if(!force_carry && from.time_of_day().minutes() == this->minute)
-            return from;
-
-        ptime t = ceil<Minute>(from, force_carry);
-        auto diff = mus<Minute>() * this->minute - t.time_of_day().total_microseconds() % mus<Hour>();
-        if(diff < 0) diff += mus<Hour>();
-        return t + microseconds(diff);
+        return next(this->minute, from, force_carry);
     }
 
     ptime Second::operator()(const ptime& from, bool force_carry){
-        if(!force_carry && from.time_of_day().seconds() == this->second)
-            return from;
-
-        ptime t = ceil<Second>(from, force_carry);
-        auto diff = mus<Second>() * this->second - t.time_of_day().total_microseconds() % mus<Minute>();
-        if(diff < 0) diff += mus<Minute>();
-        return t + microseconds(diff);
+        return next(this->second, from, force_carry);
     }
 
     ptime AllOf::operator()(const ptime& from, bool force_carry){
-        ptime t;
+        if(!force_carry){
+            return solve(this->normal_form, from);
+        }
 
-        if(force_carry){
-            t = boost::date_time::pos_infin;
-            for(auto& f: this->conditions){
-                //std::cout << t << "\n";
-                t = std::min(t, (*f)(from, true));
-            }
-            //std::cout << "final: " << t << "\n";
+        //the earliest carry of any condition, then the first instant satisfying all of them
+        ptime t = boost::date_time::pos_infin;
+        for(auto& f: this->conditions){
+            t = std::min(t, (*f)(from, true));
         }
-        else{
-            t = from;
+        return solve(this->normal_form, t);
+    }
+
+    std::size_t AllOf::fill(ptime from, bool force_carry, const ptime& until, ptime* out, std::size_t n){
+        std::vector<Cursor> cursors;
+        cursors.reserve(this->normal_form.size());
+        for(auto& term: this->normal_form){
+            cursors.emplace_back(term);
         }
 
-        ptime begin;
-        while (t != begin){
-            begin = t;
-            for(auto& f: this->conditions){
-                t = (*f)(t, false);
+        std::size_t i = 0;
+        for(; i < n; ++i){
+            //as operator() does, with the cursors in place of Fields::next
+            ptime start = from;
+            if(force_carry){
+                start = boost::date_time::pos_infin;
+                for(auto& f: this->conditions){
+                    start = std::min(start, (*f)(from, true));
+                }
+            }
+            ptime t = boost::date_time::pos_infin;
+            if(!start.is_special()){
+                for(auto& cursor: cursors){
+                    t = std::min(t, cursor.next(start));
+                }
             }
+            if(t.is_special() || t >= until)
+                break;
+            out[i] = t;
+            from = t;
+            force_carry = true;
+        }
+        return i;
+    }
+
+    ptime AllOf::solve(const Terms& terms, const ptime& from){
+        ptime t = boost::date_time::pos_infin;
+        if(from.is_special()){
+            return t;
+        }
+        for(auto& term: terms){
+            t = std::min(t, term.next(from));
         }
         return t;
     }
 
+    Terms AllOf::conjunction(const std::vector<Terms>& children){
+        Terms result{Fields::any()};
+        for(auto& child: children){
+            Terms product;
+            for(auto& f1: result){
+                for(auto& f2: child){
+                    Fields f(f1 & f2);
+                    if(!f.empty()){
+                        product.push_back(f);
+                    }
+                }
+            }
+            FirstOf::simplify(product);
+            result.swap(product);
+        }
+        return result;
+    }
+
+    const Base* AllOf::contradiction() const{
+        for(auto& f: this->conditions){
+            if(const Base* c = f->contradiction()){
+                return c;
+            }
+        }
+        return this->normal_form.empty() ? this : nullptr;
+    }
+
+    Terms FirstOf::terms() const{
+        Terms result;
+        for(auto& f: this->conditions){
+            Terms child(f->terms());
+            result.insert(result.end(), child.begin(), child.end());
+        }
+        simplify(result);
+        return result;
+    }
+
+    const Base* FirstOf::contradiction() const{
+        //a branch which can never be satisfied is merely dead, the union only
+        //when all of them are
+        for(auto& f: this->conditions){
+            if(!f->contradiction()){
+                return nullptr;
+            }
+        }
+        return this;
+    }
+
+    void FirstOf::simplify(Terms& terms){
+        //two terms differing in at most one field are the product of the union of that field
+        auto differences = [](const Fields& f1, const Fields& f2){
+            return (f1.months != f2.months) + (f1.days != f2.days) + (f1.weekdays != f2.weekdays)
+                + (f1.hours != f2.hours) + (f1.minutes != f2.minutes) + (f1.seconds != f2.seconds);
+        };
+
+        bool merged = true;
+        while(merged){
+            merged = false;
+            for(std::size_t i = 0; i < terms.size(); ++i){
+                for(std::size_t j = i + 1; j < terms.size(); ++j){
+                    if(differences(terms[i], terms[j]) <= 1){
+                        terms[i].months |= terms[j].months;
+                        terms[i].days |= terms[j].days;
+                        terms[i].weekdays |= terms[j].weekdays;
+                        terms[i].hours |= terms[j].hours;
+                        terms[i].minutes |= terms[j].minutes;
+                        terms[i].seconds |= terms[j].seconds;
+                        terms.erase(terms.begin() + j);
+                        merged = true;
+                        --j;
+                    }
+                }
+            }
+        }
+    }
+
     ptime FirstOf::operator()(const ptime& from, bool force_carry){
         ptime t;
 
@@ -317,4 +621,672 @@ namespace NextFunctor {
         }
         return t;
     }
-}
\ No newline at end of file
+
+    template <typename Solve>
+    ptime Compiled::evaluate(std::size_t begin, std::size_t end, const ptime& from, bool force_carry, Solve& solve) const{
+        using Op = Instruction::Op;
+        ptime result = boost::date_time::pos_infin;
+
+        //a firstof is the earliest of its children, so it only passes them on
+        //and this loop takes the minimum of the leaves and allofs it reaches
+        for(std::size_t pc = begin; pc < end; ++pc){
+            const Instruction& ins = this->instructions[pc];
+            ptime t;
+            switch(ins.op){
+                case Op::month:
+                    t = Month::next(static_cast<Month::source_t>(ins.value), from, force_carry);
+                    break;
+                case Op::dayofmonth:
+                    t = DayOfMonth::next(ins.value, from, force_carry);
+                    break;
+                case Op::dayofweek:
+                    t = DayOfWeek::next(static_cast<DayOfWeek::source_t>(ins.value), from, force_carry);
+                    break;
+                case Op::hour:
+                    t = Hour::next(ins.value, from, force_carry);
+                    break;
+                case Op::minute:
+                    t = Minute::next(ins.value, from, force_carry);
+                    break;
+                case Op::second:
+                    t = Second::next(ins.value, from, force_carry);
+                    break;
+                case Op::allof:{
+                    //the first instant of its normal form, after the earliest carry of
+                    //its children when carrying. Only then are they looked at
+                    ptime start = force_carry ? this->evaluate(pc + 1, pc + ins.size, from, true, solve) : from;
+                    t = boost::date_time::pos_infin;
+                    if(!start.is_special()){
+                        for(std::uint32_t i = ins.terms_begin; i < ins.terms_end; ++i){
+                            t = std::min(t, solve(i, start));
+                        }
+                    }
+                    pc += ins.size - 1;
+                    break;
+                }
+                case Op::firstof:
+                    continue;
+            }
+            result = std::min(result, t);
+        }
+        return result;
+    }
+
+    ptime Compiled::operator()(const ptime& from, bool force_carry){
+        auto solve = [this](std::uint32_t i, const ptime& t){
+            return this->term_table[i].next(t);
+        };
+        return this->evaluate(0, this->instructions.size(), from, force_carry, solve);
+    }
+
+    std::size_t Compiled::fill(ptime from, bool force_carry, const ptime& until, ptime* out, std::size_t n){
+        std::vector<Cursor> cursors;
+        cursors.reserve(this->term_table.size());
+        for(auto& term: this->term_table){
+            cursors.emplace_back(term);
+        }
+        auto solve = [&cursors](std::uint32_t i, const ptime& t){
+            return cursors[i].next(t);
+        };
+
+        std::size_t i = 0;
+        for(; i < n; ++i){
+            ptime t = this->evaluate(0, this->instructions.size(), from, force_carry, solve);
+            if(t.is_special() || t >= until)
+                break;
+            out[i] = t;
+            from = t;
+            force_carry = true;
+        }
+        return i;
+    }
+
+    Terms Compiled::normalize(std::size_t pc){
+        using Op = Instruction::Op;
+        Instruction& ins = this->instructions[pc];
+        Fields f(Fields::any());
+
+        switch(ins.op){
+            case Op::month:
+                f.months = 1 << (ins.value - 1);
+                return Terms{f};
+            case Op::dayofmonth:
+                f.days = 1u << (ins.value - 1);
+                return Terms{f};
+            case Op::dayofweek:
+                f.weekdays = 1 << ins.value;
+                return Terms{f};
+            case Op::hour:
+                f.hours = 1u << ins.value;
+                return Terms{f};
+            case Op::minute:
+                f.minutes = std::uint64_t(1) << ins.value;
+                return Terms{f};
+            case Op::second:
+                f.seconds = std::uint64_t(1) << ins.value;
+                return Terms{f};
+            case Op::allof:
+            case Op::firstof:{
+                std::vector<Terms> children;
+                std::size_t child = pc + 1;
+                for(unsigned i = 0; i < ins.count; ++i, child += this->instructions[child].size){
+                    children.push_back(this->normalize(child));
+                }
+                Terms result;
+                if(ins.op == Op::firstof){
+                    for(auto& terms: children){
+                        result.insert(result.end(), terms.begin(), terms.end());
+                    }
+                    FirstOf::simplify(result);
+                    return result;
+                }
+                result = AllOf::conjunction(children);
+                ins.terms_begin = this->term_table.size();
+                this->term_table.insert(this->term_table.end(), result.begin(), result.end());
+                ins.terms_end = this->term_table.size();
+                return result;
+            }
+        }
+        return Terms();
+    }
+
+    std::ostream& Compiled::print(std::ostream& os, std::size_t pc) const{
+        using Op = Instruction::Op;
+        const Instruction& ins = this->instructions[pc];
+
+        switch(ins.op){
+            case Op::month:
+                return os << Month(static_cast<Month::source_t>(ins.value));
+            case Op::dayofmonth:
+                return os << DayOfMonth(ins.value);
+            case Op::dayofweek:
+                return os << DayOfWeek(static_cast<DayOfWeek::source_t>(ins.value));
+            case Op::hour:
+                return os << Hour(ins.value);
+            case Op::minute:
+                return os << Minute(ins.value);
+            case Op::second:
+                return os << Second(ins.value);
+            case Op::allof:
+            case Op::firstof:{
+                bool allof = ins.op == Op::allof;
+                os << std::string(allof ? "(" : "[");
+                std::size_t child = pc + 1;
+                for(unsigned i = 0; i < ins.count; ++i, child += this->instructions[child].size){
+                    if(i > 0){
+                        os << std::string(allof ? " & " : " | ");
+                    }
+                    this->print(os, child);
+                }
+                return os << std::string(allof ? ")" : "]");
+            }
+        }
+        return os;
+    }
+
+    struct Cache::Header{
+        char magic[8];
+        std::uint32_t version;          // cache_version of the writing build
+        std::uint32_t instruction_size; // sizeof(Instruction) and sizeof(Fields) of the writing build
+        std::uint32_t fields_size;
+        std::uint32_t reserved;
+        std::uint64_t count;            // number of entries
+        std::uint64_t size;             // of the whole file
+    };
+
+    // followed at `offset` by the text, the instructions, the term table and the
+    // normal form, each padded to 8 bytes
+    struct Cache::Entry{
+        std::uint64_t hash;
+        std::uint64_t offset;
+        std::uint32_t text_size;
+        std::uint32_t code_size;
+        std::uint32_t table_size;
+        std::uint32_t normal_size;
+    };
+
+    namespace {
+        const char cache_magic[8] = {'r', 'm', 'n', 'e', 'x', 't', '\0', '\0'};
+        // bump whenever the encoding of Instruction or Fields, or what the
+        // evaluators make of them, changes: entries of other versions miss
+        const std::uint32_t cache_version = 3;
+
+        std::size_t padded(std::size_t size){
+            return (size + 7) & ~std::size_t(7);
+        }
+
+        void assign(Instruction& to, const Instruction& from){
+            to.op = from.op;
+            to.value = from.value;
+            to.count = from.count;
+            to.size = from.size;
+            to.terms_begin = from.terms_begin;
+            to.terms_end = from.terms_end;
+        }
+
+        void assign(Fields& to, const Fields& from){
+            to.months = from.months;
+            to.days = from.days;
+            to.weekdays = from.weekdays;
+            to.hours = from.hours;
+            to.minutes = from.minutes;
+            to.seconds = from.seconds;
+        }
+
+        //true if no mask has bits beyond its field and some instant satisfies all of them
+        bool well_formed(const Fields& f){
+            Fields any(Fields::any());
+            return (f.months & ~any.months) == 0 && (f.days & ~any.days) == 0 && (f.weekdays & ~any.weekdays) == 0
+                && (f.hours & ~any.hours) == 0 && (f.minutes & ~any.minutes) == 0 && (f.seconds & ~any.seconds) == 0
+                && !f.empty();
+        }
+
+        bool well_formed(const Fields* terms, std::size_t size){
+            return std::all_of(terms, terms + size, [](const Fields& f){ return well_formed(f); });
+        }
+
+        //true if the operand of a leaf lies within the range of its field
+        bool well_formed_leaf(const Instruction& ins){
+            using Op = Instruction::Op;
+            switch(ins.op){
+                case Op::month:
+                    return ins.value >= 1 && ins.value <= 12;
+                case Op::dayofmonth:
+                    return ins.value >= 1 && ins.value <= 31;
+                case Op::dayofweek:
+                    return ins.value <= 6;
+                case Op::hour:
+                    return ins.value <= 23;
+                case Op::minute:
+                case Op::second:
+                    return ins.value <= 59;
+                default:
+                    return false;
+            }
+        }
+
+        //true if code is a single, structurally sound tree of in-range leaves
+        //whose term ranges lie within the table
+        bool well_formed(const Instruction* code, std::size_t size, std::size_t table_size){
+            using Op = Instruction::Op;
+            if(size == 0 || code[0].size != size)
+                return false;
+            for(std::size_t pc = 0; pc < size; ++pc){
+                const Instruction& ins = code[pc];
+                if(ins.size == 0 || ins.size > size - pc || ins.op > Op::firstof)
+                    return false;
+                if(ins.op != Op::allof && ins.op != Op::firstof){
+                    if(ins.size != 1 || !well_formed_leaf(ins))
+                        return false;
+                    continue;
+                }
+                if(ins.op == Op::allof && (ins.terms_begin > ins.terms_end || ins.terms_end > table_size))
+                    return false;
+                std::size_t child = pc + 1;
+                for(unsigned i = 0; i < ins.count; ++i){
+                    if(child >= pc + ins.size)
+                        return false;
+                    child += code[child].size;
+                }
+                if(child != pc + ins.size)
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    Cache::Cache(const std::string& path): data(nullptr), size(0), entries(nullptr), count(0){
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0){
+            return;
+        }
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(Header))){
+            void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapped != MAP_FAILED){
+                this->data = static_cast<const char*>(mapped);
+                this->size = st.st_size;
+            }
+        }
+        close(fd);
+        if(!this->data){
+            return;
+        }
+
+        const Header* header = reinterpret_cast<const Header*>(this->data);
+        if(std::memcmp(header->magic, cache_magic, sizeof(cache_magic)) != 0
+            || header->version != cache_version
+            || header->instruction_size != sizeof(Instruction)
+            || header->fields_size != sizeof(Fields)
+            || header->size != this->size
+            || header->count > (this->size - sizeof(Header)) / sizeof(Entry)){
+            return;
+        }
+        this->entries = reinterpret_cast<const Entry*>(this->data + sizeof(Header));
+        this->count = header->count;
+    }
+
+    Cache::~Cache(){
+        if(this->data){
+            munmap(const_cast<char*>(this->data), this->size);
+        }
+    }
+
+    std::uint64_t Cache::hash(const std::string& schedule){
+        std::uint64_t h = 0xcbf29ce484222325ull;
+        for(unsigned char c: schedule){
+            h = (h ^ c) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    std::shared_ptr<Compiled> Cache::find(const std::string& schedule) const{
+        std::uint64_t h = Cache::hash(schedule);
+        const Entry* end = this->entries + this->count;
+        const Entry* entry = std::lower_bound(this->entries, end, h, [](const Entry& e, std::uint64_t h){
+            return e.hash < h;
+        });
+
+        for(; entry != end && entry->hash == h; ++entry){
+            std::size_t length = padded(entry->text_size) + padded(entry->code_size * sizeof(Instruction))
+                + padded(entry->table_size * sizeof(Fields)) + padded(entry->normal_size * sizeof(Fields));
+            if(entry->offset > this->size || length > this->size - entry->offset){
+                return nullptr;
+            }
+            const char* p = this->data + entry->offset;
+            if(entry->text_size != schedule.size() || std::memcmp(p, schedule.data(), schedule.size()) != 0){
+                continue;
+            }
+            p += padded(entry->text_size);
+            const Instruction* code = reinterpret_cast<const Instruction*>(p);
+            p += padded(entry->code_size * sizeof(Instruction));
+            const Fields* table = reinterpret_cast<const Fields*>(p);
+            p += padded(entry->table_size * sizeof(Fields));
+            const Fields* normal = reinterpret_cast<const Fields*>(p);
+
+            if(!well_formed(code, entry->code_size, entry->table_size)
+                || !well_formed(table, entry->table_size) || !well_formed(normal, entry->normal_size)){
+                return nullptr;
+            }
+            return std::make_shared<Compiled>(
+                Compiled::source_t(code, code + entry->code_size),
+                Terms(table, table + entry->table_size),
+                Terms(normal, normal + entry->normal_size));
+        }
+        return nullptr;
+    }
+
+    bool Cache::write(const std::string& path, const std::vector<std::pair<std::string, std::shared_ptr<Compiled>>>& schedules){
+        std::vector<std::pair<std::uint64_t, const std::pair<std::string, std::shared_ptr<Compiled>>*>> order;
+        for(auto& schedule: schedules){
+            order.emplace_back(Cache::hash(schedule.first), &schedule);
+        }
+        std::sort(order.begin(), order.end(), [](const decltype(order)::value_type& o1, const decltype(order)::value_type& o2){
+            return o1.first != o2.first ? o1.first < o2.first : o1.second->first < o2.second->first;
+        });
+        order.erase(std::unique(order.begin(), order.end(), [](const decltype(order)::value_type& o1, const decltype(order)::value_type& o2){
+            return o1.second->first == o2.second->first;
+        }), order.end());
+
+        std::string blobs;
+        std::vector<Entry> index;
+        std::size_t base = sizeof(Header) + order.size() * sizeof(Entry);
+        auto append = [&blobs](const void* bytes, std::size_t length){
+            blobs.append(static_cast<const char*>(bytes), length);
+            blobs.append(padded(length) - length, '\0');
+        };
+        //copies an array member by member into zeroed storage, so that no padding
+        //byte of the struct reaches the file uninitialised
+        auto append_zeroed = [&append](const auto& values){
+            using T = std::decay_t<decltype(values[0])>;
+            std::vector<T> copies(values.size());
+            std::memset(copies.data(), 0, copies.size() * sizeof(T));
+            for(std::size_t i = 0; i < values.size(); ++i){
+                assign(copies[i], values[i]);
+            }
+            append(copies.data(), copies.size() * sizeof(T));
+        };
+        for(auto& o: order){
+            const std::string& text = o.second->first;
+            const Compiled& compiled = *o.second->second;
+            Terms normal = compiled.terms();
+            index.push_back(Entry{o.first, base + blobs.size(),
+                static_cast<std::uint32_t>(text.size()), static_cast<std::uint32_t>(compiled.code().size()),
+                static_cast<std::uint32_t>(compiled.table().size()), static_cast<std::uint32_t>(normal.size())});
+            append(text.data(), text.size());
+            append_zeroed(compiled.code());
+            append_zeroed(compiled.table());
+            append_zeroed(normal);
+        }
+
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.instruction_size = sizeof(Instruction);
+        header.fields_size = sizeof(Fields);
+        header.count = index.size();
+        header.size = base + blobs.size();
+
+        //on disk before it replaces the old file, so that a crash leaves one of them intact
+        std::string temporary = path + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0){
+            return false;
+        }
+        auto write_all = [fd](const void* bytes, std::size_t length){
+            const char* p = static_cast<const char*>(bytes);
+            while(length > 0){
+                ssize_t done = ::write(fd, p, length);
+                if(done < 0 && errno == EINTR){
+                    continue;
+                }
+                if(done <= 0){
+                    return false;
+                }
+                p += done;
+                length -= done;
+            }
+            return true;
+        };
+        bool written = write_all(&header, sizeof(header))
+            && write_all(index.data(), index.size() * sizeof(Entry))
+            && write_all(blobs.data(), blobs.size())
+            && fsync(fd) == 0;
+        if(close(fd) != 0 || !written){
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    namespace {
+        //first set bit at or after `bit`, the size of the bitmap in bits if there is none. Words
+        //without any are skipped through the summary, which has a bit for every word which is not 0
+        std::size_t next_set(const std::vector<std::uint64_t>& bitmap, const std::vector<std::uint64_t>& summary, std::size_t bit){
+            std::size_t word = bit / 64;
+            if(word >= bitmap.size())
+                return bitmap.size() * 64;
+            std::uint64_t w = bitmap[word] & (~std::uint64_t(0) << (bit % 64));
+            if(w)
+                return word * 64 + __builtin_ctzll(w);
+
+            ++word;
+            for(std::size_t i = word / 64; i < summary.size(); ++i){
+                std::uint64_t s = summary[i];
+                if(i == word / 64)
+                    s &= ~std::uint64_t(0) << (word % 64);
+                if(s){
+                    std::size_t next = i * 64 + __builtin_ctzll(s);
+                    return next * 64 + __builtin_ctzll(bitmap[next]);
+                }
+            }
+            return bitmap.size() * 64;
+        }
+
+        //ors `pattern` into the bitmap from bit `offset` on
+        void insert(std::vector<std::uint64_t>& bitmap, std::size_t offset, const std::vector<std::uint64_t>& pattern){
+            std::size_t word = offset / 64;
+            unsigned shift = offset % 64;
+            if(shift == 0){
+                for(std::size_t i = 0; i < pattern.size(); ++i){
+                    bitmap[word + i] |= pattern[i];
+                }
+                return;
+            }
+            for(std::size_t i = 0; i < pattern.size(); ++i){
+                bitmap[word + i] |= pattern[i] << shift;
+                if(pattern[i] >> (64 - shift))
+                    bitmap[word + i + 1] |= pattern[i] >> (64 - shift);
+            }
+        }
+    }
+
+    Calendar::Calendar(const source_t& schedule):
+        schedule(schedule),
+        resolution(minutes(1)),
+        slots_per_day(24 * 60),
+        chunk_days(0),
+        match_terms(),
+        start_terms(),
+        match_patterns(),
+        start_patterns(),
+        chunks(),
+        unused()
+    {
+        assert(schedule);
+        std::vector<Instruction> code;
+        schedule->emit(code);
+        for(auto& ins: code){
+            if(ins.op == Instruction::Op::second){
+                resolution = seconds(1);
+                slots_per_day = 24 * 60 * 60;
+            }
+        }
+        //an even number of days, which fills whole words at either resolution
+        this->chunk_days = std::max<std::size_t>((chunk_bits / this->slots_per_day) & ~std::size_t(1), 2);
+        assert(this->chunk_days * this->slots_per_day % 64 == 0);
+
+        this->start_terms = starts(code, 0, this->match_terms);
+        this->match_patterns = this->patterns(this->match_terms);
+        this->start_patterns = this->patterns(this->start_terms);
+    }
+
+    Terms Calendar::starts(const std::vector<Instruction>& code, std::size_t pc, Terms& matches){
+        using Op = Instruction::Op;
+        const Instruction& ins = code[pc];
+
+        if(ins.op == Op::allof || ins.op == Op::firstof){
+            std::vector<Terms> children;
+            Terms result;
+            std::size_t child = pc + 1;
+            for(unsigned i = 0; i < ins.count; ++i, child += code[child].size){
+                children.emplace_back();
+                Terms s(starts(code, child, children.back()));
+                result.insert(result.end(), s.begin(), s.end());
+            }
+            if(ins.op == Op::allof){
+                matches = AllOf::conjunction(children);
+                return AllOf::conjunction({result, matches});
+            }
+            matches.clear();
+            for(auto& c: children){
+                matches.insert(matches.end(), c.begin(), c.end());
+            }
+            FirstOf::simplify(matches);
+            FirstOf::simplify(result);
+            return result;
+        }
+
+        Fields f(Fields::any());
+        switch(ins.op){
+            case Op::month:
+                f.months = 1 << (ins.value - 1);
+                break;
+            case Op::dayofmonth:
+                f.days = 1u << (ins.value - 1);
+                break;
+            case Op::dayofweek:
+                f.weekdays = 1 << ins.value;
+                break;
+            case Op::hour:
+                f.hours = 1u << ins.value;
+                break;
+            case Op::minute:
+                f.minutes = std::uint64_t(1) << ins.value;
+                break;
+            case Op::second:
+                f.seconds = std::uint64_t(1) << ins.value;
+                break;
+            case Op::allof:
+            case Op::firstof:
+                break;
+        }
+        matches = Terms{f};
+
+        //the first instant of every month, day, hour, ... the field holds on
+        if(ins.op == Op::month)
+            f.days = 1;
+        if(ins.op <= Op::dayofweek)
+            f.hours = 1;
+        if(ins.op <= Op::hour)
+            f.minutes = 1;
+        if(ins.op <= Op::minute)
+            f.seconds = 1;
+        return Terms{f};
+    }
+
+    Calendar::Patterns Calendar::patterns(const Terms& terms) const{
+        const long unit = this->resolution.total_seconds();
+        Patterns result;
+        for(auto& f: terms){
+            std::vector<std::uint64_t> pattern((this->slots_per_day + 63) / 64, 0);
+            for(std::size_t s = 0; s < this->slots_per_day; ++s){
+                long second = s * unit;
+                if((f.hours >> (second / 3600) & 1) && (f.minutes >> (second / 60 % 60) & 1) && (f.seconds >> (second % 60) & 1))
+                    pattern[s / 64] |= std::uint64_t(1) << (s % 64);
+            }
+            result.push_back(pattern);
+        }
+        return result;
+    }
+
+    void Calendar::set(std::vector<std::uint64_t>& bitmap, const date& begin, const Terms& terms, const Patterns& patterns) const{
+        //the pattern of every term goes to the days its masks hold on, found a month at a time
+        const date end = begin + boost::gregorian::days(this->chunk_days);
+        for(date d = begin; d < end; ){
+            date::ymd_type ymd = d.year_month_day();
+            int length = boost::gregorian::gregorian_calendar::end_of_month_day(ymd.year, ymd.month);
+            //day of the chunk of the first of the month, which may lie before it
+            long first = (d - begin).days() - (ymd.day - 1);
+            long last = std::min<long>(length, this->chunk_days - first);
+            std::uint32_t within = (~std::uint32_t(0) << (ymd.day - 1)) & ~(~std::uint32_t(0) << (last - 1) << 1);
+            for(std::size_t k = 0; k < terms.size(); ++k){
+                std::uint32_t days = matching_days(terms[k], ymd.year, ymd.month - 1) & within;
+                for(; days; days &= days - 1){
+                    insert(bitmap, (first + __builtin_ctz(days)) * this->slots_per_day, patterns[k]);
+                }
+            }
+            d += boost::gregorian::days(last - (ymd.day - 1));
+        }
+    }
+
+    void Calendar::append(const ptime& begin){
+        const std::size_t words = this->chunk_days * this->slots_per_day / 64;
+        Chunk chunk(std::move(this->unused));
+        chunk.begin = begin;
+        chunk.matches.assign(words, 0);
+        chunk.starts.assign(words, 0);
+        chunk.summary.assign((words + 63) / 64, 0);
+        this->set(chunk.matches, begin.date(), this->match_terms, this->match_patterns);
+        this->set(chunk.starts, begin.date(), this->start_terms, this->start_patterns);
+        for(std::size_t w = 0; w < words; ++w){
+            if(chunk.starts[w])
+                chunk.summary[w / 64] |= std::uint64_t(1) << (w % 64);
+        }
+        this->chunks.push_back(std::move(chunk));
+    }
+
+    ptime Calendar::operator()(const ptime& from, bool force_carry){
+        if(from.is_special())
+            return (*this->schedule)(from, force_carry);
+
+        //drop the chunks before `from`, start over from its day if it lies before or beyond them
+        const time_duration chunk_length = hours(24) * static_cast<int>(this->chunk_days);
+        while(!this->chunks.empty() && this->chunks.front().begin + chunk_length <= from){
+            this->unused = std::move(this->chunks.front());
+            this->chunks.pop_front();
+        }
+        if(this->chunks.empty() || from < this->chunks.front().begin){
+            //a schedule which does not occur within the horizon is not worth building it for
+            ptime t = (*this->schedule)(from, force_carry);
+            if(t >= ptime(from.date()) + chunk_length * static_cast<int>(horizon_chunks))
+                return t;
+            while(!this->chunks.empty()){
+                this->unused = std::move(this->chunks.front());
+                this->chunks.pop_front();
+            }
+            this->append(ptime(from.date()));
+        }
+
+        const Chunk& chunk = this->chunks.front();
+        std::size_t slot = (from - chunk.begin).total_microseconds() / this->resolution.total_microseconds();
+        if(!force_carry && (chunk.matches[slot / 64] >> (slot % 64) & 1)){
+            return from;
+        }
+
+        //the first start after the slot, which after a slot not matching is also the first match
+        std::size_t bit = slot + 1;
+        for(std::size_t c = 0; c < horizon_chunks; ++c, bit = 0){
+            if(c == this->chunks.size()){
+                this->append(this->chunks.back().begin + chunk_length);
+            }
+            std::size_t next = next_set(this->chunks[c].starts, this->chunks[c].summary, bit);
+            if(next < this->chunks[c].starts.size() * 64){
+                return this->chunks[c].begin + this->resolution * static_cast<int>(next);
+            }
+        }
+        //none within the horizon: the first start at or after its end
+        return (*this->schedule)(this->chunks.back().begin + chunk_length - this->resolution, true);
+    }
+}
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
+#include <deque>
+#include <iterator>
 #include <memory>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -9,6 +14,73 @@
 namespace NextFunctor{
     using boost::posix_time::ptime;
 
+    // one node of a schedule in its flattened, preorder form (see Compiled)
+    struct Instruction{
+        enum class Op: std::uint16_t { month, dayofmonth, dayofweek, hour, minute, second, allof, firstof };
+        Op op;
+        std::uint16_t value; // operand of leaf ops
+        std::uint32_t count; // number of direct children of allof / firstof
+        std::uint32_t size;  // number of instructions in this subtree, including itself
+        std::uint32_t terms_begin; // allof: range of its normal form in Compiled's term table
+        std::uint32_t terms_end;
+    };
+
+    // A conjunction of per-field conditions: all instants whose month, day of
+    // month, weekday, hour, minute and second lie in the respective masks.
+    // Every schedule is a union of these (see Base::terms).
+    struct Fields{
+        std::uint16_t months;  // bit m - 1 for month m
+        std::uint32_t days;    // bit d - 1 for day of month d
+        std::uint8_t weekdays; // bit w for weekday w, Sunday = 0
+        std::uint32_t hours;
+        std::uint64_t minutes;
+        std::uint64_t seconds;
+
+        static constexpr Fields any(){
+            return Fields{0xfff, 0x7fffffff, 0x7f, 0xffffff, (std::uint64_t(1) << 60) - 1, (std::uint64_t(1) << 60) - 1};
+        }
+        friend constexpr Fields operator&(const Fields& f1, const Fields& f2){
+            return Fields{
+                static_cast<std::uint16_t>(f1.months & f2.months),
+                f1.days & f2.days,
+                static_cast<std::uint8_t>(f1.weekdays & f2.weekdays),
+                f1.hours & f2.hours,
+                f1.minutes & f2.minutes,
+                f1.seconds & f2.seconds
+            };
+        }
+        friend bool operator==(const Fields& f1, const Fields& f2);
+        // true if no instant satisfies all masks
+        constexpr bool empty() const{
+            if(!this->months || !this->days || !this->weekdays || !this->hours || !this->minutes || !this->seconds)
+                return true;
+
+            //every date exists on every weekday within the 400 year cycle of the calendar,
+            //so only the combination of month and day of month can be impossible
+            constexpr int longest_month[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+            for(int m = 0; m < 12; ++m){
+                if((this->months >> m & 1) && (this->days & ((std::uint64_t(1) << longest_month[m]) - 1)))
+                    return false;
+            }
+            return true;
+        }
+        bool contains(const ptime& t) const;
+        // first instant at or after `from` satisfying all masks, pos_infin if none
+        ptime next(const ptime& from) const;
+    };
+    using Terms = std::vector<Fields>;
+
+#ifdef NEXT_STATISTICS
+    // work counters for next_bench, only maintained in builds defining NEXT_STATISTICS
+    struct Statistics{
+        unsigned long long solves; // calls of Fields::next
+        unsigned long long steps;  // months examined by them
+    };
+    extern thread_local Statistics statistics;
+#endif
+
+    class Occurrences;
+
     class Base{
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const = 0;
@@ -20,7 +92,89 @@ namespace NextFunctor{
             return base.ostream_operator(os);
         }
 
+        // appends the flattened form of this node to code
+        virtual void emit(std::vector<Instruction>& code) const = 0;
+        // the instants satisfying this node as a union of Fields
+        virtual Terms terms() const = 0;
+        // the outermost subexpression which can never be satisfied, if any
+        virtual const Base* contradiction() const {
+            return this->terms().empty() ? this : nullptr;
+        }
+
+        // writes up to n successive occurrences before `until` to out and returns
+        // their number: the first is (*this)(from, force_carry), every further
+        // one is (*this)(previous, true)
+        virtual std::size_t fill(ptime from, bool force_carry, const ptime& until, ptime* out, std::size_t n);
+        // all occurrences in [begin, end)
+        Occurrences occurrences(const ptime& begin, const ptime& end);
+        // the next `count` occurrences at or after `from`
+        Occurrences occurrences(const ptime& from, std::size_t count);
+
         static std::shared_ptr<Base> parse(const std::string& str);
+        // parse followed by conversion into a Compiled
+        static std::shared_ptr<Base> compile(const std::string& str);
+    };
+
+    // Input range over the occurrences of a schedule, fetched in batches via
+    // Base::fill. The schedule must outlive the range.
+    class Occurrences{
+    public:
+        class iterator{
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = ptime;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const ptime*;
+            using reference = const ptime&;
+
+            iterator(): range(nullptr){}
+            explicit iterator(Occurrences* range): range(range->exhausted() ? nullptr : range){}
+            reference operator*() const {
+                return this->range->buffer[this->range->position];
+            }
+            pointer operator->() const {
+                return &**this;
+            }
+            iterator& operator++(){
+                this->range->advance();
+                if(this->range->exhausted()){
+                    this->range = nullptr;
+                }
+                return *this;
+            }
+            friend bool operator==(const iterator& it1, const iterator& it2){
+                return it1.range == it2.range;
+            }
+            friend bool operator!=(const iterator& it1, const iterator& it2){
+                return it1.range != it2.range;
+            }
+        private:
+            Occurrences* range;
+        };
+
+        static constexpr std::size_t batch_size = 64;
+
+        Occurrences(Base& schedule, const ptime& from, const ptime& until, std::size_t count);
+        iterator begin(){
+            return iterator(this);
+        }
+        iterator end(){
+            return iterator();
+        }
+    private:
+        bool exhausted() const {
+            return this->position == this->buffer.size();
+        }
+        void advance();
+        void refill();
+
+        Base& schedule;
+        ptime from;
+        bool force_carry;
+        ptime until;
+        std::size_t remaining;
+        std::vector<ptime> buffer;
+        std::size_t position;
     };
 
     class Month: public Base{
@@ -29,6 +183,15 @@ namespace NextFunctor{
         Month(const source_t& month): month(month){}
         virtual ~Month() = default;
         virtual ptime operator()(const ptime& from, bool force_carry) override;
+        virtual void emit(std::vector<Instruction>& code) const override {
+            code.push_back(Instruction{Instruction::Op::month, static_cast<std::uint16_t>(this->month), 0, 1, 0, 0});
+        }
+        virtual Terms terms() const override {
+            Fields f(Fields::any());
+            f.months = 1 << (this->month - 1);
+            return Terms{f};
+        }
+        static ptime next(const source_t& month, const ptime& from, bool force_carry);
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const override {
             using moy = boost::date_time::months_of_year;
@@ -93,6 +256,15 @@ namespace NextFunctor{
         }
         virtual ~DayOfMonth() = default;
         virtual ptime operator()(const ptime& from, bool force_carry) override;
+        virtual void emit(std::vector<Instruction>& code) const override {
+            code.push_back(Instruction{Instruction::Op::dayofmonth, static_cast<std::uint16_t>(this->dayofmonth), 0, 1, 0, 0});
+        }
+        virtual Terms terms() const override {
+            Fields f(Fields::any());
+            f.days = 1u << (this->dayofmonth - 1);
+            return Terms{f};
+        }
+        static ptime next(const source_t& dayofmonth, const ptime& from, bool force_carry);
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const override {
             return os << std::to_string(this->dayofmonth) << std::string("d");
@@ -107,6 +279,15 @@ namespace NextFunctor{
         DayOfWeek(const source_t& dayofweek): dayofweek(dayofweek){}
         virtual ~DayOfWeek() = default;
         virtual ptime operator()(const ptime& from, bool force_carry) override;
+        virtual void emit(std::vector<Instruction>& code) const override {
+            code.push_back(Instruction{Instruction::Op::dayofweek, static_cast<std::uint16_t>(this->dayofweek), 0, 1, 0, 0});
+        }
+        virtual Terms terms() const override {
+            Fields f(Fields::any());
+            f.weekdays = 1 << this->dayofweek;
+            return Terms{f};
+        }
+        static ptime next(const source_t& dayofweek, const ptime& from, bool force_carry);
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const override {
             using wd = boost::date_time::weekdays;
@@ -148,6 +329,15 @@ namespace NextFunctor{
         }
         virtual ~Hour() = default;
         virtual ptime operator()(const ptime& from, bool) override;
+        virtual void emit(std::vector<Instruction>& code) const override {
+            code.push_back(Instruction{Instruction::Op::hour, static_cast<std::uint16_t>(this->hour), 0, 1, 0, 0});
+        }
+        virtual Terms terms() const override {
+            Fields f(Fields::any());
+            f.hours = 1u << this->hour;
+            return Terms{f};
+        }
+        static ptime next(const source_t& hour, const ptime& from, bool force_carry);
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const override {
             return os << std::to_string(this->hour) << std::string("H");
@@ -165,6 +355,15 @@ namespace NextFunctor{
         }
         virtual ~Minute() = default;
         virtual ptime operator()(const ptime& from, bool force_carry) override;
+        virtual void emit(std::vector<Instruction>& code) const override {
+            code.push_back(Instruction{Instruction::Op::minute, static_cast<std::uint16_t>(this->minute), 0, 1, 0, 0});
+        }
+        virtual Terms terms() const override {
+            Fields f(Fields::any());
+            f.minutes = std::uint64_t(1) << this->minute;
+            return Terms{f};
+        }
+        static ptime next(const source_t& minute, const ptime& from, bool force_carry);
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const override {
             return os << std::to_string(this->minute) << std::string("M");
@@ -182,6 +381,15 @@ namespace NextFunctor{
         }
         virtual ~Second() = default;
         virtual ptime operator()(const ptime& from, bool force_carry) override;
+        virtual void emit(std::vector<Instruction>& code) const override {
+            code.push_back(Instruction{Instruction::Op::second, static_cast<std::uint16_t>(this->second), 0, 1, 0, 0});
+        }
+        virtual Terms terms() const override {
+            Fields f(Fields::any());
+            f.seconds = std::uint64_t(1) << this->second;
+            return Terms{f};
+        }
+        static ptime next(const source_t& second, const ptime& from, bool force_carry);
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const override {
             return os << std::to_string(this->second) << std::string("S");
@@ -190,16 +398,157 @@ namespace NextFunctor{
         source_t second;
     };
 
+    // microseconds per unit of a time of day condition
+    template <typename T>
+    constexpr long mus();
+
+    template <>
+    constexpr long mus<Second>(){
+        return 1e6;
+    }
+
+    template <>
+    constexpr long mus<Minute>(){
+        return mus<Second>() * 60;
+    }
+
+    template <>
+    constexpr long mus<Hour>(){
+        return mus<Minute>() * 60;
+    }
+
+    // the beginning of the next unit of T at or after t, after t if force_carry
+    template <typename T>
+    inline ptime ceil(ptime t, bool force_carry){
+        long rem = t.time_of_day().total_microseconds() % mus<T>();
+        if(!force_carry && rem == 0)
+            return t;
+        else
+            return t + boost::posix_time::microseconds(-rem) + boost::posix_time::microseconds(mus<T>());
+    }
+
+    template <>
+    inline ptime ceil<DayOfMonth>(ptime t, bool force_carry){
+        long rem = t.time_of_day().total_microseconds();
+        if(!force_carry && rem == 0)
+            return t;
+        else{
+            return t + boost::posix_time::microseconds(-rem) + boost::gregorian::days(1);
+        }
+    }
+
+    template <>
+    inline ptime ceil<Month>(ptime t, bool force_carry){
+        if(!force_carry && t.time_of_day().total_microseconds() == 0 && t.date().day() == 1)
+            return t;
+        else{
+            boost::gregorian::date d = (t.date() - boost::gregorian::days(t.date().day() - 1)) + boost::gregorian::months(1);
+            return ptime(d, boost::posix_time::time_duration(0,0,0,0));
+        }
+    }
+
+    // the leaf conditions are defined here so that evaluators built at compile time (see Static) can inline them
+
+    inline ptime Month::next(const source_t& month, const ptime& from, bool force_carry){
+        if(!force_carry && from.date().month() == month)
+            return from;
+
+        ptime t = ceil<Month>(from, force_carry);
+        auto mon_diff = month - t.date().month();
+        if (mon_diff < 0) mon_diff += 12;
+        return t + boost::gregorian::months(mon_diff);
+    }
+
+    inline ptime DayOfMonth::next(const source_t& dayofmonth, const ptime& from, bool force_carry){
+        if(!force_carry && from.date().day() == dayofmonth)
+            return from;
+
+        ptime t = ceil<DayOfMonth>(from, force_carry);
+        auto day_diff = dayofmonth - t.date().day();
+        if (day_diff < 0){
+            t = ceil<Month>(from, true);
+            day_diff = dayofmonth - 1;
+        }
+        //skip months which are too short, e.g. to the next month with a 31st
+        while (dayofmonth > boost::gregorian::gregorian_calendar::end_of_month_day(t.date().year(), t.date().month())){
+            t = ceil<Month>(t, true);
+            day_diff = dayofmonth - 1;
+        }
+        return t + boost::gregorian::days(day_diff);
+    }
+
+    inline ptime DayOfWeek::next(const source_t& dayofweek, const ptime& from, bool force_carry){
+        if(!force_carry && from.date().day_of_week() == dayofweek)
+            return from;
+
+        ptime t = ceil<DayOfMonth>(from, force_carry);
+        boost::gregorian::date d = t.date();
+        d = next_weekday(d, boost::gregorian::greg_weekday(dayofweek));
+        return ptime(d, boost::posix_time::time_duration(0,0,0,0));
+    }
+
+    inline ptime Hour::next(const source_t& hour, const ptime& from, bool force_carry){
+        if(!force_carry && from.time_of_day().hours() == hour)
+            return from;
+        ptime t = ceil<Hour>(from, force_carry);
+        auto diff = mus<Hour>() * hour - t.time_of_day().total_microseconds();
+        if(diff < 0) diff += mus<Hour>() * 24;
+        return t + boost::posix_time::microseconds(diff);
+    }
+
+    inline ptime Minute::next(const source_t& minute, const ptime& from, bool force_carry){
+        if(!force_carry && from.time_of_day().minutes() == minute)
+            return from;
+
+        ptime t = ceil<Minute>(from, force_carry);
+        auto diff = mus<Minute>() * minute - t.time_of_day().total_microseconds() % mus<Hour>();
+        if(diff < 0) diff += mus<Hour>();
+        return t + boost::posix_time::microseconds(diff);
+    }
+
+    inline ptime Second::next(const source_t& second, const ptime& from, bool force_carry){
+        if(!force_carry && from.time_of_day().seconds() == second)
+            return from;
+
+        ptime t = ceil<Second>(from, force_carry);
+        auto diff = mus<Second>() * second - t.time_of_day().total_microseconds() % mus<Minute>();
+        if(diff < 0) diff += mus<Minute>();
+        return t + boost::posix_time::microseconds(diff);
+    }
+
     class AllOf: public Base{
     public:
         using element_t = std::shared_ptr<Base>;
         using source_t = std::vector<element_t>;
         template <typename InputIterator>
-        AllOf(InputIterator begin, InputIterator end): conditions(begin, end){
+        AllOf(InputIterator begin, InputIterator end): conditions(begin, end), normal_form(){
             assert(conditions.size() > 0);
+            std::vector<Terms> children;
+            for(auto& f: this->conditions){
+                children.push_back(f->terms());
+            }
+            normal_form = conjunction(children);
         }
         virtual ~AllOf() = default;
         virtual ptime operator()(const ptime& from, bool force_carry) override;
+        // keeps the matching days of the current month of every term across the results
+        virtual std::size_t fill(ptime from, bool force_carry, const ptime& until, ptime* out, std::size_t n) override;
+        virtual Terms terms() const override {
+            return this->normal_form;
+        }
+        virtual const Base* contradiction() const override;
+        // the normal form of the conjunction of the given normal forms
+        static Terms conjunction(const std::vector<Terms>& children);
+        // first instant at or after `from` contained in any of the terms
+        static ptime solve(const Terms& terms, const ptime& from);
+        virtual void emit(std::vector<Instruction>& code) const override {
+            std::size_t begin = code.size();
+            code.push_back(Instruction{Instruction::Op::allof, 0, static_cast<std::uint32_t>(this->conditions.size()), 0, 0, 0});
+            for(auto& f: this->conditions){
+                f->emit(code);
+            }
+            code[begin].size = code.size() - begin;
+        }
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const override {
             auto it = this->conditions.begin();
@@ -211,6 +560,7 @@ namespace NextFunctor{
         }
     private:
         source_t conditions;
+        Terms normal_form;
     };
 
     class FirstOf: public Base{
@@ -223,6 +573,18 @@ namespace NextFunctor{
         }
         virtual ~FirstOf() = default;
         virtual ptime operator()(const ptime& from, bool force_carry) override;
+        virtual Terms terms() const override;
+        virtual const Base* contradiction() const override;
+        // merges terms differing in a single field and drops duplicates
+        static void simplify(Terms& terms);
+        virtual void emit(std::vector<Instruction>& code) const override {
+            std::size_t begin = code.size();
+            code.push_back(Instruction{Instruction::Op::firstof, 0, static_cast<std::uint32_t>(this->conditions.size()), 0, 0, 0});
+            for(auto& f: this->conditions){
+                f->emit(code);
+            }
+            code[begin].size = code.size() - begin;
+        }
     protected:
         virtual std::ostream& ostream_operator(std::ostream& os) const override {
             auto it = this->conditions.begin();
@@ -235,4 +597,759 @@ namespace NextFunctor{
     private:
         source_t conditions;
     };
+
+    // Flat, preorder instruction array built from a parsed tree. Evaluation
+    // is a single loop over the array instead of a walk of shared_ptr
+    // children; the results are identical to the tree's.
+    class Compiled: public Base{
+    public:
+        using source_t = std::vector<Instruction>;
+        Compiled(const Base& tree): instructions(), term_table(), normal_form(){
+            tree.emit(instructions);
+            assert(instructions.size() > 0);
+            normal_form = this->normalize(0);
+        }
+        // from the parts of another Compiled, e.g. as stored in a Cache
+        Compiled(source_t instructions, Terms term_table, Terms normal_form):
+            instructions(std::move(instructions)), term_table(std::move(term_table)), normal_form(std::move(normal_form)){
+            assert(this->instructions.size() > 0);
+        }
+        virtual ~Compiled() = default;
+        virtual ptime operator()(const ptime& from, bool force_carry) override;
+        // keeps the matching days of the current month of every term across the results
+        virtual std::size_t fill(ptime from, bool force_carry, const ptime& until, ptime* out, std::size_t n) override;
+        virtual void emit(std::vector<Instruction>& code) const override {
+            code.insert(code.end(), this->instructions.begin(), this->instructions.end());
+        }
+        virtual Terms terms() const override {
+            return this->normal_form;
+        }
+        const source_t& code() const {
+            return this->instructions;
+        }
+        const Terms& table() const {
+            return this->term_table;
+        }
+    protected:
+        virtual std::ostream& ostream_operator(std::ostream& os) const override {
+            return this->print(os, 0);
+        }
+    private:
+        // the earliest result of the instructions in [begin, end) which are not below an allof among
+        // them. solve(i, t) is the first instant at or after t in term i of the table
+        template <typename Solve>
+        ptime evaluate(std::size_t begin, std::size_t end, const ptime& from, bool force_carry, Solve& solve) const;
+        std::ostream& print(std::ostream& os, std::size_t pc) const;
+        // fills in the term ranges of all allof instructions below pc, returns the normal form of pc
+        Terms normalize(std::size_t pc);
+        source_t instructions;
+        Terms term_table;
+        Terms normal_form;
+    };
+
+    // A file of Compiled schedules keyed by a hash of their text. It is mapped
+    // and searched in place, so a schedule compiled by an earlier run is
+    // neither parsed nor normalized again. Files written by another build or
+    // cache version are treated like a missing file: every lookup misses. So
+    // are entries that do not pass validation, which are then compiled anew.
+    class Cache{
+    public:
+        explicit Cache(const std::string& path);
+        ~Cache();
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+
+        // the schedule compiled from `schedule`, nullptr if there is none; thread safe
+        std::shared_ptr<Compiled> find(const std::string& schedule) const;
+        // replaces the file at path by one holding `schedules`, false on failure
+        static bool write(const std::string& path, const std::vector<std::pair<std::string, std::shared_ptr<Compiled>>>& schedules);
+        // FNV-1a
+        static std::uint64_t hash(const std::string& schedule);
+    private:
+        struct Header;
+        struct Entry;
+        const char* data;
+        std::size_t size;
+        const Entry* entries;
+        std::size_t count;
+    };
+
+    // Precomputed occurrences of a schedule over a rolling horizon. Two bitmaps
+    // hold one bit per slot (a minute, or a second if the schedule has Second
+    // conditions): `matches` marks slots satisfying the schedule, `starts`
+    // marks the instants returned by operator()(_, true). Both are set from the
+    // masks of a union of Fields a day at a time, so lookups become a word
+    // scan. The horizon is a queue of chunks of whole days, starting with the
+    // chunk of the latest query and holding at most horizon_chunks; answers
+    // beyond it come from the wrapped schedule.
+    class Calendar: public Base{
+    public:
+        using source_t = std::shared_ptr<Base>;
+        static constexpr std::size_t chunk_bits = std::size_t(1) << 17; // about 16 KiB per bitmap and chunk
+        static constexpr std::size_t horizon_chunks = 2;
+
+        Calendar(const source_t& schedule);
+        virtual ~Calendar() = default;
+        virtual ptime operator()(const ptime& from, bool force_carry) override;
+        virtual void emit(std::vector<Instruction>& code) const override {
+            this->schedule->emit(code);
+        }
+        virtual Terms terms() const override {
+            return this->schedule->terms();
+        }
+        // the instants operator()(_, true) of the instruction at pc returns: where
+        // the field of a condition begins to hold, where one of the conditions of
+        // an allof does so within its normal form and where any of those of a
+        // firstof does. Sets `matches` to the normal form of pc
+        static Terms starts(const std::vector<Instruction>& code, std::size_t pc, Terms& matches);
+    protected:
+        virtual std::ostream& ostream_operator(std::ostream& os) const override {
+            return os << *this->schedule;
+        }
+    private:
+        struct Chunk{
+            ptime begin;
+            std::vector<std::uint64_t> matches;
+            std::vector<std::uint64_t> starts;
+            std::vector<std::uint64_t> summary; // bit w for every word w of starts which is not 0
+        };
+        // one day of slots per term
+        using Patterns = std::vector<std::vector<std::uint64_t>>;
+
+        Patterns patterns(const Terms& terms) const;
+        void set(std::vector<std::uint64_t>& bitmap, const boost::gregorian::date& begin, const Terms& terms, const Patterns& patterns) const;
+        void append(const ptime& begin);
+
+        source_t schedule;
+        boost::posix_time::time_duration resolution;
+        std::size_t slots_per_day;
+        std::size_t chunk_days;
+        Terms match_terms;
+        Terms start_terms;
+        Patterns match_patterns;
+        Patterns start_patterns;
+        std::deque<Chunk> chunks;
+        Chunk unused; // the last one dropped, whose bitmaps the next one reuses
+    };
+
+    // Compile time front end for schedules fixed in the code. A literal such as
+    //
+    //     using namespace NextFunctor::Literals;
+    //     auto news = "(0M & [MON | TUE | WED | THU | FRI])"_schedule;
+    //     ptime t = news(from, true);
+    //
+    // is parsed by the compiler, which reports syntax errors and values out of
+    // range as errors. The result is an empty object whose type is the schedule:
+    // every node is a template specialized per node type, and the normal form of
+    // every conjunction is a constant computed by the compiler. Evaluating it
+    // needs no parsing, allocation or virtual call: leaves call their condition,
+    // conjunctions solve their constant terms. Its results are those of
+    // Base::parse for the same text, and schedules which parse rejects as
+    // contradictions are compile errors. Literal<> turns it into a Base where one
+    // is needed.
+    namespace Static{
+        template <char... Cs>
+        struct Text{
+            static constexpr char chars[sizeof...(Cs) + 1] = {Cs..., '\0'};
+            static constexpr std::size_t size = sizeof...(Cs);
+        };
+        template <char... Cs>
+        constexpr char Text<Cs...>::chars[];
+
+        enum class Kind { invalid, month, dayofweek, dayofmonth, hour, minute, second, hour_minute, allof, firstof };
+        enum class Error { none, empty, unknown, range, brackets, separator };
+
+        constexpr std::size_t npos = ~std::size_t(0);
+
+        constexpr bool digit(char c){
+            return c >= '0' && c <= '9';
+        }
+
+        constexpr bool blank(char c){
+            return c == ' ' || c == '\t';
+        }
+
+        constexpr std::size_t skip_blanks(const char* s, std::size_t i, std::size_t end){
+            while(i < end && blank(s[i])){
+                ++i;
+            }
+            return i;
+        }
+
+        constexpr int number(const char* s, std::size_t i){
+            // the digits at i, capped far beyond every valid value
+            int n = 0;
+            for(; digit(s[i]); ++i){
+                n = std::min(n * 10 + (s[i] - '0'), 1000);
+            }
+            return n;
+        }
+
+        constexpr std::size_t colon(const char* s, std::size_t i){
+            while(s[i] != ':'){
+                ++i;
+            }
+            return i;
+        }
+
+        constexpr int name(const char* s, std::size_t i, const char* const* names, int count){
+            // index of the three letter name at i, -1 if none
+            for(int n = 0; n < count; ++n){
+                if(s[i] == names[n][0] && s[i + 1] == names[n][1] && s[i + 2] == names[n][2]){
+                    return n;
+                }
+            }
+            return -1;
+        }
+
+        constexpr int month(const char* s, std::size_t i){
+            constexpr const char* names[] = {"JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"};
+            int n = name(s, i, names, 12);
+            return n < 0 ? -1 : n + 1;
+        }
+
+        constexpr int dayofweek(const char* s, std::size_t i){
+            constexpr const char* names[] = {"SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT"};
+            return name(s, i, names, 7);
+        }
+
+        constexpr std::size_t condition_end(const char* s, std::size_t i, std::size_t end){
+            // the end of the condition beginning at i, i if there is none and npos if its brackets are unbalanced
+            if(i >= end){
+                return i;
+            }
+            if(s[i] == '(' || s[i] == '['){
+                int depth = 0;
+                for(std::size_t j = i; j < end; ++j){
+                    depth += (s[j] == '(' || s[j] == '[') - (s[j] == ')' || s[j] == ']');
+                    if(depth == 0){
+                        return j + 1;
+                    }
+                }
+                return npos;
+            }
+            std::size_t j = i;
+            if(s[j] >= 'A' && s[j] <= 'Z'){
+                while(j < end && s[j] >= 'A' && s[j] <= 'Z'){
+                    ++j;
+                }
+                return j;
+            }
+            while(j < end && digit(s[j])){
+                ++j;
+            }
+            if(j == i || j == end){
+                return j;
+            }
+            if(s[j] == ':'){
+                for(++j; j < end && digit(s[j]); ++j){}
+                return j;
+            }
+            return s[j] == 'd' || s[j] == 'H' || s[j] == 'M' || s[j] == 'S' ? j + 1 : j;
+        }
+
+        constexpr Kind kind(const char* s, std::size_t begin, std::size_t end){
+            if(begin >= end){
+                return Kind::invalid;
+            }
+            if(s[begin] == '(' || s[begin] == '['){
+                bool all = s[begin] == '(';
+                return s[end - 1] != (all ? ')' : ']') ? Kind::invalid : all ? Kind::allof : Kind::firstof;
+            }
+            if(end - begin == 3 && month(s, begin) > 0){
+                return Kind::month;
+            }
+            if(end - begin == 3 && dayofweek(s, begin) >= 0){
+                return Kind::dayofweek;
+            }
+            std::size_t i = begin;
+            while(i < end && digit(s[i])){
+                ++i;
+            }
+            if(i == begin || i == end){
+                return Kind::invalid;
+            }
+            if(s[i] == ':'){
+                return i + 1 < end && condition_end(s, begin, end) == end ? Kind::hour_minute : Kind::invalid;
+            }
+            if(i + 1 != end){
+                return Kind::invalid;
+            }
+            switch(s[i]){
+                case 'd': return Kind::dayofmonth;
+                case 'H': return Kind::hour;
+                case 'M': return Kind::minute;
+                case 'S': return Kind::second;
+                default: return Kind::invalid;
+            }
+        }
+
+        constexpr std::size_t child(const char* s, std::size_t begin, std::size_t end, std::size_t n){
+            // beginning of the n-th condition of the group in [begin, end), npos after the last one
+            std::size_t i = skip_blanks(s, begin + 1, end - 1);
+            for(; i < end - 1; --n){
+                if(n == 0){
+                    return i;
+                }
+                std::size_t next = condition_end(s, i, end - 1);
+                if(next == npos || next == i){
+                    break;
+                }
+                i = skip_blanks(s, next, end - 1);
+                if(i < end - 1){
+                    i = skip_blanks(s, i + 1, end - 1);
+                }
+            }
+            return npos;
+        }
+
+        constexpr std::size_t children(const char* s, std::size_t begin, std::size_t end){
+            std::size_t n = 0;
+            while(child(s, begin, end, n) != npos){
+                ++n;
+            }
+            return n;
+        }
+
+        constexpr Error check(const char* s, std::size_t begin, std::size_t end){
+            // whether [begin, end) holds exactly one condition, with all of its values in range
+            if(begin == end){
+                return Error::empty;
+            }
+            std::size_t stop = condition_end(s, begin, end);
+            if(stop == npos){
+                return Error::brackets;
+            }
+            Kind k = kind(s, begin, end);
+            if(stop != end || k == Kind::invalid){
+                return Error::unknown;
+            }
+            switch(k){
+                case Kind::dayofmonth:
+                    return number(s, begin) >= 1 && number(s, begin) <= 31 ? Error::none : Error::range;
+                case Kind::hour:
+                    return number(s, begin) <= 23 ? Error::none : Error::range;
+                case Kind::minute:
+                case Kind::second:
+                    return number(s, begin) <= 59 ? Error::none : Error::range;
+                case Kind::hour_minute:
+                    return number(s, begin) <= 23 && number(s, colon(s, begin) + 1) <= 59 ? Error::none : Error::range;
+                case Kind::allof:
+                case Kind::firstof:{
+                    char separator = k == Kind::allof ? '&' : '|';
+                    std::size_t i = skip_blanks(s, begin + 1, end - 1);
+                    if(i == end - 1){
+                        return Error::empty;
+                    }
+                    while(true){
+                        std::size_t next = condition_end(s, i, end - 1);
+                        if(next == npos){
+                            return Error::brackets;
+                        }
+                        if(next == i){
+                            return Error::unknown;
+                        }
+                        Error error = check(s, i, next);
+                        if(error != Error::none){
+                            return error;
+                        }
+                        i = skip_blanks(s, next, end - 1);
+                        if(i == end - 1){
+                            return Error::none;
+                        }
+                        if(s[i] != separator){
+                            return Error::separator;
+                        }
+                        i = skip_blanks(s, i + 1, end - 1);
+                        if(i == end - 1){
+                            return Error::empty;
+                        }
+                    }
+                }
+                default:
+                    return Error::none;
+            }
+        }
+
+        // the runtime class of every kind of leaf
+        template <Instruction::Op Op>
+        struct LeafType;
+        template <>
+        struct LeafType<Instruction::Op::month>{
+            using type = NextFunctor::Month;
+        };
+        template <>
+        struct LeafType<Instruction::Op::dayofmonth>{
+            using type = NextFunctor::DayOfMonth;
+        };
+        template <>
+        struct LeafType<Instruction::Op::dayofweek>{
+            using type = NextFunctor::DayOfWeek;
+        };
+        template <>
+        struct LeafType<Instruction::Op::hour>{
+            using type = NextFunctor::Hour;
+        };
+        template <>
+        struct LeafType<Instruction::Op::minute>{
+            using type = NextFunctor::Minute;
+        };
+        template <>
+        struct LeafType<Instruction::Op::second>{
+            using type = NextFunctor::Second;
+        };
+
+        // a normal form as a value the compiler computes: the first `count` of
+        // at most N terms
+        template <std::size_t N>
+        struct TermList{
+            Fields terms[N];
+            std::size_t count;
+
+            Terms vector() const {
+                return Terms(this->terms, this->terms + this->count);
+            }
+            // first instant at or after `from` contained in any of the terms
+            ptime solve(const ptime& from) const {
+                ptime t = boost::date_time::pos_infin;
+                if(from.is_special()){
+                    return t;
+                }
+                for(std::size_t i = 0; i < this->count; ++i){
+                    t = std::min(t, this->terms[i].next(from));
+                }
+                return t;
+            }
+        };
+
+        constexpr Fields leaf_fields(Instruction::Op op, int value){
+            Fields f = Fields::any();
+            switch(op){
+                case Instruction::Op::month:
+                    f.months = static_cast<std::uint16_t>(1 << (value - 1));
+                    break;
+                case Instruction::Op::dayofmonth:
+                    f.days = 1u << (value - 1);
+                    break;
+                case Instruction::Op::dayofweek:
+                    f.weekdays = static_cast<std::uint8_t>(1 << value);
+                    break;
+                case Instruction::Op::hour:
+                    f.hours = 1u << value;
+                    break;
+                case Instruction::Op::minute:
+                    f.minutes = std::uint64_t(1) << value;
+                    break;
+                case Instruction::Op::second:
+                    f.seconds = std::uint64_t(1) << value;
+                    break;
+                default:
+                    break;
+            }
+            return f;
+        }
+
+        // FirstOf::simplify on a TermList
+        template <std::size_t N>
+        constexpr TermList<N> simplified(TermList<N> list){
+            bool merged = true;
+            while(merged){
+                merged = false;
+                for(std::size_t i = 0; i < list.count; ++i){
+                    for(std::size_t j = i + 1; j < list.count; ++j){
+                        Fields& f1 = list.terms[i];
+                        const Fields& f2 = list.terms[j];
+                        int differences = (f1.months != f2.months) + (f1.days != f2.days) + (f1.weekdays != f2.weekdays)
+                            + (f1.hours != f2.hours) + (f1.minutes != f2.minutes) + (f1.seconds != f2.seconds);
+                        if(differences <= 1){
+                            f1.months |= f2.months;
+                            f1.days |= f2.days;
+                            f1.weekdays |= f2.weekdays;
+                            f1.hours |= f2.hours;
+                            f1.minutes |= f2.minutes;
+                            f1.seconds |= f2.seconds;
+                            for(std::size_t k = j + 1; k < list.count; ++k){
+                                list.terms[k - 1] = list.terms[k];
+                            }
+                            --list.count;
+                            merged = true;
+                            --j;
+                        }
+                    }
+                }
+            }
+            return list;
+        }
+
+        // the first terms of list, which holds no more than N of them
+        template <std::size_t N, std::size_t M>
+        constexpr TermList<N> trimmed(const TermList<M>& list){
+            TermList<N> result{};
+            for(; result.count < list.count; ++result.count){
+                result.terms[result.count] = list.terms[result.count];
+            }
+            return result;
+        }
+
+        // AllOf::conjunction on TermLists, one child after the other
+        template <std::size_t N>
+        constexpr TermList<N> conjunction(const TermList<N>& result){
+            return result;
+        }
+        template <std::size_t N, std::size_t M, typename... Rest>
+        constexpr auto conjunction(const TermList<N>& result, const TermList<M>& child, const Rest&... rest){
+            TermList<N * M> product{};
+            for(std::size_t i = 0; i < result.count; ++i){
+                for(std::size_t j = 0; j < child.count; ++j){
+                    Fields f = result.terms[i] & child.terms[j];
+                    if(!f.empty()){
+                        product.terms[product.count++] = f;
+                    }
+                }
+            }
+            return conjunction(simplified(product), rest...);
+        }
+
+        template <typename... Children>
+        constexpr auto conjunction(){
+            return conjunction(TermList<1>{{Fields::any()}, 1}, Children::normal_form()...);
+        }
+
+        // FirstOf::terms on TermLists
+        template <std::size_t N>
+        constexpr TermList<N> disjunction(const TermList<N>& result){
+            return simplified(result);
+        }
+        template <std::size_t N, std::size_t M, typename... Rest>
+        constexpr auto disjunction(const TermList<N>& result, const TermList<M>& child, const Rest&... rest){
+            TermList<N + M> sum = trimmed<N + M>(result);
+            for(std::size_t j = 0; j < child.count; ++j){
+                sum.terms[sum.count++] = child.terms[j];
+            }
+            return disjunction(sum, rest...);
+        }
+
+        template <typename... Children>
+        constexpr auto disjunction(){
+            return disjunction(TermList<1>{{}, 0}, Children::normal_form()...);
+        }
+
+        template <Instruction::Op Op, int Value>
+        struct Leaf{
+            using node_t = typename LeafType<Op>::type;
+            static typename node_t::source_t value(){
+                return static_cast<typename node_t::source_t>(Value);
+            }
+            static constexpr std::size_t bound = 1;
+            static constexpr TermList<1> normal_form(){
+                return TermList<1>{{leaf_fields(Op, Value)}, 1};
+            }
+            static ptime next(const ptime& from, bool force_carry){
+                return node_t::next(value(), from, force_carry);
+            }
+            static Terms terms(){
+                return normal_form().vector();
+            }
+            static void emit(std::vector<Instruction>& code){
+                node_t(value()).emit(code);
+            }
+            static std::ostream& print(std::ostream& os){
+                return os << node_t(value());
+            }
+            ptime operator()(const ptime& from, bool force_carry) const {
+                return next(from, force_carry);
+            }
+        };
+
+        template <typename... Children>
+        struct AllOf{
+            // the number of terms of the normal form, at least one
+            static constexpr std::size_t bound = std::max<std::size_t>(conjunction<Children...>().count, 1);
+            static constexpr TermList<bound> normal_form(){
+                return trimmed<bound>(conjunction<Children...>());
+            }
+            static ptime next(const ptime& from, bool force_carry){
+                //constant initialized, so neither computed nor guarded at run time
+                static constexpr TermList<bound> normal = normal_form();
+                if(!force_carry){
+                    return normal.solve(from);
+                }
+                //the earliest carry of any condition, then the first instant satisfying all of them
+                const ptime carries[] = {Children::next(from, true)...};
+                ptime t = boost::date_time::pos_infin;
+                for(auto& carry: carries){
+                    t = std::min(t, carry);
+                }
+                return normal.solve(t);
+            }
+            static Terms terms(){
+                return normal_form().vector();
+            }
+            static void emit(std::vector<Instruction>& code){
+                std::size_t begin = code.size();
+                code.push_back(Instruction{Instruction::Op::allof, 0, static_cast<std::uint32_t>(sizeof...(Children)), 0, 0, 0});
+                const int expand[] = {(Children::emit(code), 0)...};
+                (void) expand;
+                code[begin].size = code.size() - begin;
+            }
+            static std::ostream& print(std::ostream& os){
+                bool first = true;
+                os << std::string("(");
+                const int expand[] = {(os << std::string(first ? "" : " & "), first = false, Children::print(os), 0)...};
+                (void) expand;
+                return os << std::string(")");
+            }
+            ptime operator()(const ptime& from, bool force_carry) const {
+                return next(from, force_carry);
+            }
+        };
+
+        template <typename... Children>
+        struct FirstOf{
+            static ptime next(const ptime& from, bool force_carry){
+                const ptime results[] = {Children::next(from, force_carry)...};
+                ptime t;
+                for(auto& result: results){
+                    t = t == ptime() ? result : std::min(t, result);
+                }
+                return t;
+            }
+            static constexpr std::size_t bound = std::max<std::size_t>(disjunction<Children...>().count, 1);
+            static constexpr TermList<bound> normal_form(){
+                return trimmed<bound>(disjunction<Children...>());
+            }
+            static Terms terms(){
+                return normal_form().vector();
+            }
+            static void emit(std::vector<Instruction>& code){
+                std::size_t begin = code.size();
+                code.push_back(Instruction{Instruction::Op::firstof, 0, static_cast<std::uint32_t>(sizeof...(Children)), 0, 0, 0});
+                const int expand[] = {(Children::emit(code), 0)...};
+                (void) expand;
+                code[begin].size = code.size() - begin;
+            }
+            static std::ostream& print(std::ostream& os){
+                bool first = true;
+                os << std::string("[");
+                const int expand[] = {(os << std::string(first ? "" : " | "), first = false, Children::print(os), 0)...};
+                (void) expand;
+                return os << std::string("]");
+            }
+            ptime operator()(const ptime& from, bool force_carry) const {
+                return next(from, force_carry);
+            }
+        };
+
+        // the type of the condition in [Begin, End) of T, which has been checked
+        template <typename T, std::size_t Begin, std::size_t End, Kind K = kind(T::chars, Begin, End)>
+        struct Build;
+
+        template <typename T, std::size_t Begin, std::size_t End, template <typename...> class Node,
+            typename Indices = std::make_index_sequence<children(T::chars, Begin, End)>>
+        struct Group;
+        template <typename T, std::size_t Begin, std::size_t End, template <typename...> class Node, std::size_t... I>
+        struct Group<T, Begin, End, Node, std::index_sequence<I...>>{
+            using type = Node<typename Build<T, child(T::chars, Begin, End, I), condition_end(T::chars, child(T::chars, Begin, End, I), End - 1)>::type...>;
+        };
+
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::month>{
+            using type = Leaf<Instruction::Op::month, month(T::chars, Begin)>;
+        };
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::dayofweek>{
+            using type = Leaf<Instruction::Op::dayofweek, dayofweek(T::chars, Begin)>;
+        };
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::dayofmonth>{
+            using type = Leaf<Instruction::Op::dayofmonth, number(T::chars, Begin)>;
+        };
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::hour>{
+            using type = Leaf<Instruction::Op::hour, number(T::chars, Begin)>;
+        };
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::minute>{
+            using type = Leaf<Instruction::Op::minute, number(T::chars, Begin)>;
+        };
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::second>{
+            using type = Leaf<Instruction::Op::second, number(T::chars, Begin)>;
+        };
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::hour_minute>{
+            //like the parser, HH:MM is (HH & MM)
+            using type = AllOf<
+                Leaf<Instruction::Op::hour, number(T::chars, Begin)>,
+                Leaf<Instruction::Op::minute, number(T::chars, colon(T::chars, Begin) + 1)>
+            >;
+        };
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::allof>{
+            using type = typename Group<T, Begin, End, AllOf>::type;
+        };
+        template <typename T, std::size_t Begin, std::size_t End>
+        struct Build<T, Begin, End, Kind::firstof>{
+            using type = typename Group<T, Begin, End, FirstOf>::type;
+        };
+
+        // stands in for a schedule which did not compile, after the error has been reported
+        struct Invalid{
+            using type = Invalid;
+        };
+
+        // whether some instant satisfies Node, as Base::contradiction decides it
+        template <typename Node>
+        struct Satisfiable{
+            static constexpr bool value = Node::normal_form().count > 0;
+        };
+        template <>
+        struct Satisfiable<Invalid>{
+            static constexpr bool value = true;
+        };
+
+        template <typename T>
+        struct Parse{
+            static constexpr Error error = check(T::chars, 0, T::size);
+            static_assert(error != Error::empty, "schedule literal: empty condition");
+            static_assert(error != Error::unknown, "schedule literal: unknown condition or characters after it");
+            static_assert(error != Error::range, "schedule literal: value out of range");
+            static_assert(error != Error::brackets, "schedule literal: unbalanced brackets");
+            static_assert(error != Error::separator, "schedule literal: '&' separates the conditions within (), '|' those within []");
+            using type = typename std::conditional<error == Error::none, Build<T, 0, T::size>, Invalid>::type::type;
+            static_assert(Satisfiable<type>::value, "schedule literal: can never be satisfied");
+        };
+    }
+
+    // a schedule literal as a Base, e.g. for Programme::next
+    template <typename Node>
+    class Literal: public Base{
+    public:
+        using source_t = Node;
+        Literal() = default;
+        Literal(const Node&){}
+        virtual ~Literal() = default;
+        virtual ptime operator()(const ptime& from, bool force_carry) override {
+            return Node::next(from, force_carry);
+        }
+        virtual void emit(std::vector<Instruction>& code) const override {
+            Node::emit(code);
+        }
+        virtual Terms terms() const override {
+            return Node::terms();
+        }
+    protected:
+        virtual std::ostream& ostream_operator(std::ostream& os) const override {
+            return Node::print(os);
+        }
+    };
+
+    namespace Literals{
+        // "..."_schedule, a string literal operator template as supported by GCC and Clang
+        template <typename CharT, CharT... Cs>
+        constexpr typename Static::Parse<Static::Text<Cs...>>::type operator"" _schedule(){
+            static_assert(std::is_same<CharT, char>::value, "schedule literals are narrow strings");
+            return {};
+        }
+    }
 }
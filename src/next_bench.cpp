@@ -0,0 +1,191 @@
+#include "next.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+// Benchmark of the schedule engines. Prints one tab separated line per
+// schedule, engine and kind of query:
+//
+//   schedule  engine  query  calls  ns_per_call  allocations_per_call  solves_per_call  steps_per_call
+//
+// `chain` follows the occurrences like Scheduler::run does (force_carry),
+// `batch` follows them 64 at a time through Base::fill, per occurrence,
+// `scatter` asks for the next occurrence from times spread over a year.
+// solves and steps count calls of Fields::next, or of the month cursors of
+// fill, and the months examined by them, which is what used to be the
+// fixpoint iteration of AllOf.
+
+namespace {
+    std::size_t allocations = 0;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void* operator new(std::size_t size){
+    ++allocations;
+    if(void* p = std::malloc(size ? size : 1)){
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#pragma GCC diagnostic pop
+
+namespace {
+    using NextFunctor::Base;
+    using f_ptr = std::shared_ptr<NextFunctor::Base>;
+    using boost::posix_time::ptime;
+    using boost::posix_time::seconds;
+    using boost::posix_time::time_duration;
+    using boost::gregorian::date;
+
+    std::vector<std::string> schedules(){
+        std::vector<std::string> result {
+            //etc/config.production
+            "0M", "0S", "18:30", "18:40", "9:45",
+            "(00:00 & SUN)", "(00:05 & SAT)", "(01:05 & [TUE | WED | THU | FRI | SAT])",
+            "(11:05 & SAT)", "(11:05 & SUN)", "(12:00 & SUN)", "(13:30 & SUN)", "(14:05 & FRI)",
+            "(16:30 & SAT)", "(16:35 & [MON | TUE | WED | THU | FRI])", "(17:05 & SAT)", "(17:05 & SUN)",
+            "(17:30 & SUN)", "(18:05 & [MON | TUE | WED | THU | FRI | SAT])", "(19:04 & [MON | TUE | WED | THU | FRI])",
+            "(19:05 & MON)", "(19:15 & MON)", "(19:15 & TUE)", "(20:04 & [MON | TUE | WED | THU | FRI | SUN])",
+            "(20:05 & FRI)", "(20:05 & SUN)", "(20:05 & THU)", "(20:05 & TUE)", "(20:05 & WED)",
+            "(20:10 & FRI)", "(20:10 & THU)", "(21:05 & MON)", "(21:05 & SAT)", "(21:05 & SUN)",
+            "(21:05 & WED)", "(22:05 & [MON | TUE | WED | THU | FRI])", "(22:30 & FRI)", "(22:30 & SUN)",
+            "(22:30 & [MON | TUE | WED | THU | FRI])", "(23:05 & MON)", "(23:05 & SAT)", "(23:05 & SUN)",
+            "(23:05 & THU)", "(23:10 & [MON | TUE | WED | THU | FRI])", "(23:30 & [MON | TUE | WED | THU | FRI])",
+            //sparse conjunctions
+            "(29d & FEB & MON)", "(31d & SUN & 23:59)", "(13d & FRI & 13:13 & 13S)",
+            "(WED & 13S & [(MAR & 12M) | JAN | (FRI & 17H)])"
+        };
+
+        //deep nesting
+        std::string nested("0S");
+        for(int i = 0; i < 16; ++i){
+            std::string h(std::to_string(i) + "H");
+            nested = i % 2 ? "[" + nested + " | (" + h + " & " + std::to_string(i) + "M)]" : "(" + nested + " & [SAT | SUN | " + h + "])";
+        }
+        result.push_back(nested);
+
+        //wide FirstOf lists
+        const char* weekdays[] = {"MON", "TUE", "WED", "THU", "FRI", "SAT", "SUN"};
+        std::string wide("[");
+        for(int i = 0; i < 60; ++i){
+            wide += std::string(i ? " | " : "") + "(" + weekdays[i % 7] + " & " + std::to_string(i % 24) + ":" + std::to_string(i) + ")";
+        }
+        result.push_back(wide + "]");
+
+        return result;
+    }
+
+    struct Measurement{
+        std::size_t calls;
+        double ns_per_call;
+        double allocations_per_call;
+        double solves_per_call;
+        double steps_per_call;
+    };
+
+    template <typename Query>
+    Measurement measure(std::size_t max_calls, Query query){
+        using clock = std::chrono::steady_clock;
+        const auto budget = std::chrono::milliseconds(200);
+
+        std::size_t allocations_before = allocations;
+        NextFunctor::Statistics statistics_before = NextFunctor::statistics;
+        auto begin = clock::now();
+        auto end = begin;
+
+        std::size_t calls = 0;
+        while(calls < max_calls){
+            query(calls++);
+            if(calls % 64 == 0 && (end = clock::now()) - begin > budget){
+                break;
+            }
+        }
+        end = clock::now();
+
+        double n = calls;
+        return Measurement{
+            calls,
+            std::chrono::duration<double, std::nano>(end - begin).count() / n,
+            (allocations - allocations_before) / n,
+            (NextFunctor::statistics.solves - statistics_before.solves) / n,
+            (NextFunctor::statistics.steps - statistics_before.steps) / n
+        };
+    }
+}
+
+int main(int argc, const char* argv[]){
+    std::size_t max_calls = argc > 1 ? std::stoul(argv[1]) : 100000;
+
+    const ptime start(date(2016, boost::date_time::Jan, 1), time_duration(0,0,0,0));
+    //keeps sparse schedules far away from the end of the supported date range
+    const ptime wrap(date(2400, boost::date_time::Jan, 1), time_duration(0,0,0,0));
+
+    std::cout << "schedule\tengine\tquery\tcalls\tns_per_call\tallocations_per_call\tsolves_per_call\tsteps_per_call\n";
+
+    for(auto& schedule: schedules()){
+        f_ptr tree(Base::parse(schedule));
+        if(!tree){
+            return EXIT_FAILURE;
+        }
+
+        const std::vector<std::pair<std::string, f_ptr>> engines {
+            {"tree", tree},
+            {"compiled", Base::compile(schedule)},
+            {"calendar", std::make_shared<NextFunctor::Calendar>(Base::compile(schedule))}
+        };
+
+        for(auto& engine: engines){
+            Base& f = *engine.second;
+
+            ptime t = f(start, false);
+            Measurement chain = measure(max_calls, [&](std::size_t){
+                t = f(t, true);
+                if(t >= wrap){
+                    t = f(start, false);
+                }
+            });
+
+            //the same walk through Base::fill, reported per occurrence
+            ptime b = f(start, false);
+            ptime batch_buffer[NextFunctor::Occurrences::batch_size];
+            std::size_t occurrences = 0;
+            Measurement batch = measure((max_calls + NextFunctor::Occurrences::batch_size - 1) / NextFunctor::Occurrences::batch_size, [&](std::size_t){
+                std::size_t filled = f.fill(b, true, wrap, batch_buffer, NextFunctor::Occurrences::batch_size);
+                occurrences += filled;
+                b = filled > 0 ? batch_buffer[filled - 1] : f(start, false);
+            });
+            double per_occurrence = batch.calls / static_cast<double>(std::max<std::size_t>(occurrences, 1));
+            batch.calls = occurrences;
+            batch.ns_per_call *= per_occurrence;
+            batch.allocations_per_call *= per_occurrence;
+            batch.solves_per_call *= per_occurrence;
+            batch.steps_per_call *= per_occurrence;
+
+            //a fixed, irregular walk through one year
+            Measurement scatter = measure(max_calls, [&](std::size_t i){
+                f(start + seconds(static_cast<long>(i * 7919 % 31536000)), false);
+            });
+
+            for(auto& m: {std::make_pair("chain", chain), std::make_pair("batch", batch), std::make_pair("scatter", scatter)}){
+                std::cout << schedule << "\t" << engine.first << "\t" << m.first << "\t" << m.second.calls
+                    << "\t" << m.second.ns_per_call << "\t" << m.second.allocations_per_call
+                    << "\t" << m.second.solves_per_call << "\t" << m.second.steps_per_call << "\n";
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,433 @@
+#include "next.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+
+// Differential test of the schedule engines against a reference evaluator on
+// random schedules and times:
+//
+//   next_diff [schedules] [times_per_schedule] [seed]
+//
+// The reference knows nothing of normal forms, bitmaps or solvers. It checks
+// the conditions of the schedule directly on every second, skipping months,
+// days, hours and minutes in which they cannot all hold. Prints every
+// mismatch (up to a limit), then one tab separated line per engine:
+//
+//   engine  queries  mismatches  ns_per_query  speedup_over_reference
+//
+// and exits with EXIT_FAILURE if any engine disagreed with the reference.
+
+namespace {
+    using NextFunctor::Base;
+    using f_ptr = std::shared_ptr<NextFunctor::Base>;
+    using boost::posix_time::ptime;
+    using boost::posix_time::time_duration;
+    using boost::posix_time::hours;
+    using boost::posix_time::minutes;
+    using boost::posix_time::seconds;
+    using boost::posix_time::microseconds;
+    using boost::gregorian::date;
+
+    // a schedule as generated, independent of the classes in next.h
+    struct Node{
+        enum class Kind { month, dayofmonth, dayofweek, hour, minute, second, allof, firstof };
+        Kind kind;
+        int value;
+        std::vector<Node> children;
+    };
+
+    std::string print(const Node& node){
+        static const char* months[] = {"JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"};
+        static const char* weekdays[] = {"SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT"};
+        switch(node.kind){
+            case Node::Kind::month:
+                return months[node.value - 1];
+            case Node::Kind::dayofmonth:
+                return std::to_string(node.value) + "d";
+            case Node::Kind::dayofweek:
+                return weekdays[node.value];
+            case Node::Kind::hour:
+                return std::to_string(node.value) + "H";
+            case Node::Kind::minute:
+                return std::to_string(node.value) + "M";
+            case Node::Kind::second:
+                return std::to_string(node.value) + "S";
+            case Node::Kind::allof:
+            case Node::Kind::firstof:{
+                bool allof = node.kind == Node::Kind::allof;
+                std::string result(allof ? "(" : "[");
+                for(std::size_t i = 0; i < node.children.size(); ++i){
+                    result += (i ? (allof ? " & " : " | ") : "") + print(node.children[i]);
+                }
+                return result + (allof ? ")" : "]");
+            }
+        }
+        return std::string();
+    }
+
+    // the kinds of conditions in the tree, one bit each
+    unsigned kinds(const Node& node){
+        unsigned result = 1u << static_cast<int>(node.kind);
+        for(auto& child: node.children){
+            result |= kinds(child);
+        }
+        return result;
+    }
+
+    class Generator{
+    public:
+        explicit Generator(unsigned seed): random(seed){}
+
+        // nested AllOf / FirstOf trees of up to `depth` levels. Leaves are drawn
+        // mostly from small ranges, so that conjunctions are often satisfiable.
+        // The parts of a conjunction never both have minute or second conditions:
+        // one which cannot hold, like (1S & 2S) within [... | MON], would have the
+        // reference try every second of the week
+        Node schedule(int depth){
+            if(depth == 0 || this->uniform(0, 2) == 0){
+                return this->leaf();
+            }
+            Node node{this->uniform(0, 1) ? Node::Kind::allof : Node::Kind::firstof, 0, {}};
+            int count = this->uniform(2, 4);
+            unsigned used = 0;
+            for(int i = 0; i < count; ++i){
+                Node child = this->schedule(depth - 1);
+                while(node.kind == Node::Kind::allof && (kinds(child) & used & fine) != 0){
+                    child = this->schedule(depth - 1);
+                }
+                used |= kinds(child);
+                node.children.push_back(std::move(child));
+            }
+            return node;
+        }
+
+        // within four years around a leap day, mostly close to the boundaries of
+        // minutes, hours, days and months, where the engines carry, and sometimes
+        // with a fraction of a second
+        ptime time(){
+            ptime t(date(this->uniform(2015, 2018), this->uniform(1, 12), this->uniform(1, 28)),
+                hours(this->uniform(0, 23)) + minutes(this->uniform(0, 59)) + seconds(this->uniform(0, 59)));
+            switch(this->uniform(0, 5)){
+                case 0:
+                    t = ptime(date(t.date().year(), t.date().month(), 1)) - seconds(this->uniform(0, 1));
+                    break;
+                case 1:
+                    t = ptime(t.date()) - seconds(this->uniform(0, 1));
+                    break;
+                case 2:
+                    t = ptime(t.date(), hours(t.time_of_day().hours())) + seconds(this->uniform(-1, 0));
+                    break;
+                case 3:
+                    t -= seconds(t.time_of_day().seconds());
+                    break;
+            }
+            if(this->uniform(0, 7) == 0){
+                t += microseconds(this->uniform(1, 999999));
+            }
+            return t;
+        }
+
+    private:
+        static constexpr unsigned fine = 1u << static_cast<int>(Node::Kind::minute) | 1u << static_cast<int>(Node::Kind::second);
+
+        int uniform(int min, int max){
+            return std::uniform_int_distribution<int>(min, max)(this->random);
+        }
+
+        Node leaf(){
+            switch(this->uniform(0, 5)){
+                case 0:
+                    return Node{Node::Kind::month, this->uniform(1, 12), {}};
+                case 1:
+                    return Node{Node::Kind::dayofmonth, this->uniform(0, 3) ? this->uniform(1, 4) : this->uniform(28, 31), {}};
+                case 2:
+                    return Node{Node::Kind::dayofweek, this->uniform(0, 6), {}};
+                case 3:
+                    return Node{Node::Kind::hour, this->uniform(0, 3) ? this->uniform(0, 3) : this->uniform(0, 23), {}};
+                case 4:
+                    return Node{Node::Kind::minute, this->uniform(0, 3) ? this->uniform(0, 3) : this->uniform(0, 59), {}};
+                default:
+                    return Node{Node::Kind::second, this->uniform(0, 3) ? this->uniform(0, 3) : this->uniform(0, 59), {}};
+            }
+        }
+
+        std::mt19937 random;
+    };
+
+    // the reference evaluator
+    class Reference{
+    public:
+        // answers beyond `horizon` after the query are reported as pos_infin
+        Reference(const Node& schedule, const time_duration& horizon): schedule(schedule), horizon(horizon){}
+
+        ptime operator()(const ptime& from, bool force_carry) const {
+            return this->next(this->schedule, from, force_carry, from + this->horizon);
+        }
+
+    private:
+        enum class Truth { no, maybe, yes };
+        // the units of time the search steps through, coarsest first
+        enum class Unit { month, day, hour, minute, second };
+
+        static Truth leaf(bool known, bool holds){
+            return !known ? Truth::maybe : holds ? Truth::yes : Truth::no;
+        }
+
+        // the fields of an instant, in the order of Node::Kind
+        struct Point{
+            int fields[6];
+
+            explicit Point(const ptime& t){
+                const date d = t.date();
+                const time_duration time = t.time_of_day();
+                int values[6] = {d.month(), d.day(), d.day_of_week(), static_cast<int>(time.hours()), static_cast<int>(time.minutes()), static_cast<int>(time.seconds())};
+                std::copy(values, values + 6, this->fields);
+            }
+        };
+
+        // whether the node holds throughout the unit containing the point, at no instant of it, or it depends
+        static Truth holds(const Node& node, const Point& point, Unit unit){
+            // the finest unit whose value each kind of condition depends on
+            static const Unit units[] = {Unit::month, Unit::day, Unit::day, Unit::hour, Unit::minute, Unit::second};
+            switch(node.kind){
+                case Node::Kind::month:
+                case Node::Kind::dayofmonth:
+                case Node::Kind::dayofweek:
+                case Node::Kind::hour:
+                case Node::Kind::minute:
+                case Node::Kind::second:{
+                    int kind = static_cast<int>(node.kind);
+                    return leaf(unit >= units[kind], point.fields[kind] == node.value);
+                }
+                case Node::Kind::allof:{
+                    Truth result = Truth::yes;
+                    for(auto& child: node.children){
+                        result = std::min(result, holds(child, point, unit));
+                    }
+                    return result;
+                }
+                case Node::Kind::firstof:{
+                    Truth result = Truth::no;
+                    for(auto& child: node.children){
+                        result = std::max(result, holds(child, point, unit));
+                    }
+                    return result;
+                }
+            }
+            return Truth::no;
+        }
+
+        static ptime floor(const ptime& t, Unit unit){
+            const time_duration time = t.time_of_day();
+            switch(unit){
+                case Unit::month:
+                    return ptime(date(t.date().year(), t.date().month(), 1));
+                case Unit::day:
+                    return ptime(t.date());
+                case Unit::hour:
+                    return ptime(t.date(), hours(time.hours()));
+                case Unit::minute:
+                    return ptime(t.date(), hours(time.hours()) + minutes(time.minutes()));
+                case Unit::second:
+                    return ptime(t.date(), hours(time.hours()) + minutes(time.minutes()) + seconds(time.seconds()));
+            }
+            return t;
+        }
+
+        static ptime step(const ptime& t, Unit unit){
+            switch(unit){
+                case Unit::month:
+                    return ptime(t.date().end_of_month() + boost::gregorian::days(1));
+                case Unit::day:
+                    return t + boost::gregorian::days(1);
+                case Unit::hour:
+                    return t + hours(1);
+                case Unit::minute:
+                    return t + minutes(1);
+                case Unit::second:
+                    return t + seconds(1);
+            }
+            return t;
+        }
+
+        // the first instant at or after `from` at which the node holds
+        static ptime search(const Node& node, const ptime& from, const ptime& until){
+            if(holds(node, Point(from), Unit::second) == Truth::yes){
+                return from;
+            }
+            ptime t = step(floor(from, Unit::second), Unit::second);
+            while(t < until){
+                Point point(t);
+                bool skipped = false;
+                for(Unit unit: {Unit::month, Unit::day, Unit::hour, Unit::minute}){
+                    if(holds(node, point, unit) == Truth::no){
+                        t = step(floor(t, unit), unit);
+                        skipped = true;
+                        break;
+                    }
+                }
+                if(skipped){
+                    continue;
+                }
+                if(holds(node, point, Unit::second) == Truth::yes){
+                    return t;
+                }
+                t = step(t, Unit::second);
+            }
+            return boost::date_time::pos_infin;
+        }
+
+        // force_carry is defined structurally, as by the classes in next.h: a condition moves on
+        // to the next month, day, hour, minute or second it holds in, a disjunction to the nearest
+        // of its alternatives, and a conjunction to where it holds again once a part has moved on.
+        // A part found nowhere within the horizon never holds, like (3H & 4H) in [MON | (3H & 4H)],
+        // and is not searched again
+        ptime next(const Node& node, const ptime& from, bool force_carry, const ptime& until) const {
+            if(this->dead.count(&node)){
+                return boost::date_time::pos_infin;
+            }
+            ptime t = this->carry(node, from, force_carry, until);
+            if(t.is_pos_infinity()){
+                this->dead.insert(&node);
+            }
+            return t;
+        }
+
+        ptime carry(const Node& node, const ptime& from, bool force_carry, const ptime& until) const {
+            if(!force_carry){
+                return search(node, from, until);
+            }
+            switch(node.kind){
+                case Node::Kind::month:
+                    return search(node, step(floor(from, Unit::month), Unit::month), until);
+                case Node::Kind::dayofmonth:
+                case Node::Kind::dayofweek:
+                    return search(node, step(floor(from, Unit::day), Unit::day), until);
+                case Node::Kind::hour:
+                    return search(node, step(floor(from, Unit::hour), Unit::hour), until);
+                case Node::Kind::minute:
+                    return search(node, step(floor(from, Unit::minute), Unit::minute), until);
+                case Node::Kind::second:
+                    return search(node, step(floor(from, Unit::second), Unit::second), until);
+                case Node::Kind::allof:
+                case Node::Kind::firstof:{
+                    ptime t = boost::date_time::pos_infin;
+                    for(auto& child: node.children){
+                        t = std::min(t, this->next(child, from, true, until));
+                    }
+                    if(node.kind == Node::Kind::firstof || t.is_special()){
+                        return t;
+                    }
+                    return search(node, t, until);
+                }
+            }
+            return boost::date_time::pos_infin;
+        }
+
+        const Node& schedule;
+        const time_duration horizon;
+        mutable std::set<const Node*> dead;
+    };
+
+    struct Query{
+        ptime from;
+        bool force_carry;
+        ptime expected;
+    };
+
+    struct Engine{
+        std::string name;
+        std::size_t queries;
+        std::size_t mismatches;
+        double ns;
+    };
+}
+
+int main(int argc, const char* argv[]){
+    std::size_t schedule_count = argc > 1 ? std::stoul(argv[1]) : 2000;
+    std::size_t time_count = argc > 2 ? std::stoul(argv[2]) : 500;
+    unsigned seed = argc > 3 ? std::stoul(argv[3]) : 1;
+    const std::size_t max_reported = 20;
+
+    using clock = std::chrono::steady_clock;
+    // the sparsest schedules the generator makes, like (29d & FEB & MON), recur within 28 years
+    const time_duration horizon = hours(24 * 366 * 29);
+
+    Generator generator(seed);
+    std::vector<Engine> engines {{"reference", 0, 0, 0}, {"tree", 0, 0, 0}, {"compiled", 0, 0, 0}, {"calendar", 0, 0, 0}};
+    std::size_t reported = 0;
+
+    for(std::size_t s = 0; s < schedule_count; ){
+        Node node = generator.schedule(3);
+        std::string schedule = print(node);
+        // the generator does not avoid contradictions, the parser rejects those of the whole schedule (and says so)
+        std::streambuf* out = std::cout.rdbuf(nullptr);
+        f_ptr tree(Base::parse(schedule));
+        std::cout.rdbuf(out);
+        if(!tree){
+            continue;
+        }
+        ++s;
+
+        Reference reference(node, horizon);
+        std::vector<Query> queries;
+        auto begin = clock::now();
+        std::vector<ptime> times;
+        for(std::size_t i = 0; i < time_count; ++i){
+            times.push_back(generator.time());
+        }
+        // in order, as the Scheduler asks, so that the calendar's rolling horizon does not start over
+        std::sort(times.begin(), times.end());
+        for(auto& from: times){
+            for(bool force_carry: {false, true}){
+                queries.push_back(Query{from, force_carry, reference(from, force_carry)});
+            }
+        }
+        engines[0].ns += std::chrono::duration<double, std::nano>(clock::now() - begin).count();
+        engines[0].queries += queries.size();
+
+        const f_ptr implementations[] = {tree, Base::compile(schedule), std::make_shared<NextFunctor::Calendar>(Base::compile(schedule))};
+        for(std::size_t e = 0; e < 3; ++e){
+            Base& f = *implementations[e];
+            Engine& engine = engines[e + 1];
+            std::vector<ptime> results(queries.size());
+
+            begin = clock::now();
+            for(std::size_t i = 0; i < queries.size(); ++i){
+                results[i] = f(queries[i].from, queries[i].force_carry);
+            }
+            engine.ns += std::chrono::duration<double, std::nano>(clock::now() - begin).count();
+            engine.queries += queries.size();
+
+            for(std::size_t i = 0; i < queries.size(); ++i){
+                const Query& query = queries[i];
+                // the reference gives up at the horizon
+                bool agree = results[i] == query.expected
+                    || (query.expected.is_pos_infinity() && (results[i].is_pos_infinity() || results[i] >= query.from + horizon));
+                if(agree){
+                    continue;
+                }
+                ++engine.mismatches;
+                if(reported++ < max_reported){
+                    std::cout << "MISMATCH " << engine.name << "\t" << schedule << "\t" << query.from << "\t" << (query.force_carry ? "carry" : "-")
+                        << "\texpected " << query.expected << "\tgot " << results[i] << "\n";
+                }
+            }
+        }
+    }
+
+    std::cout << "engine\tqueries\tmismatches\tns_per_query\tspeedup_over_reference\n";
+    const double reference_ns = engines[0].ns / engines[0].queries;
+    bool failed = false;
+    for(auto& engine: engines){
+        double ns = engine.ns / engine.queries;
+        std::cout << engine.name << "\t" << engine.queries << "\t" << engine.mismatches << "\t" << ns << "\t" << reference_ns / ns << "\n";
+        failed = failed || engine.mismatches > 0;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
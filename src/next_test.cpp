@@ -1,9 +1,30 @@
 #include "next.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace {
+    // asserts that a and b give the same results, with and without force_carry,
+    // at instants spread over [begin, end)
+    template <typename A, typename B>
+    void agree(A&& a, B&& b, const boost::posix_time::ptime& begin, const boost::posix_time::ptime& end){
+        const boost::posix_time::time_duration step = boost::posix_time::minutes(97) + boost::posix_time::seconds(13);
+        for(boost::posix_time::ptime t = begin; t < end; t += step){
+            assert(a(t, false) == b(t, false));
+            assert(a(t, true) == b(t, true));
+        }
+    }
+}
 
 int main(){
     using NextFunctor::Base;
+    using NextFunctor::Occurrences;
     using f_ptr = std::shared_ptr<NextFunctor::Base>;
     using boost::posix_time::ptime;
     using boost::posix_time::microseconds;
@@ -187,4 +208,333 @@ int main(){
 
         std::cout << "OK\n\n";
     }
-}
\ No newline at end of file
+
+    {
+        std::cout << "=== TEST compiled (tree and compiled agree) ===\n\n";
+
+        const std::vector<std::string> schedules {
+            "(8H & 37M)",
+            "(WED & 13S & [(MAR & 12M) | JAN | (FRI & 17H)])",
+            "16:30",
+            "(WED & 14H)",
+            "(WED & 14H & 5M)",
+            "(WED & [13H|4H] & 5M)",
+            "0M",
+            "(01:05 & [TUE | WED | THU | FRI | SAT])",
+            "[SAT | (SUN & 12H) | 0M]"
+        };
+
+        for(auto& schedule: schedules){
+            f_ptr tree(Base::parse(schedule));
+            f_ptr compiled(Base::compile(schedule));
+
+            std::ostringstream tree_str, compiled_str;
+            tree_str << *tree;
+            compiled_str << *compiled;
+            std::cout << compiled_str.str() << "\n";
+            assert(tree_str.str() == compiled_str.str());
+
+            agree(*tree, *compiled, ptime(date(2016, moy::Jan, 1)), ptime(date(2018, moy::Jan, 1)));
+        }
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST calendar (tree and calendar agree) ===\n\n";
+
+        const std::vector<std::string> schedules {
+            "(8H & 37M)",
+            "(WED & 13S & [(MAR & 12M) | JAN | (FRI & 17H)])",
+            "0M",
+            "MON",
+            "(01:05 & [TUE | WED | THU | FRI | SAT])",
+            "[SAT | (SUN & 12H) | 0M]",
+            "[MON | 5M]",
+            "[5H | 30M]",
+            "(5H & [MON | 30M])",
+            "(29d & FEB & MON)",
+            "(31d & SUN & 23:59)",
+            "[(13d & FRI & 13:13 & 13S) | (DEC & 24d & 0:0)]"
+        };
+
+        for(auto& schedule: schedules){
+            f_ptr tree(Base::parse(schedule));
+            f_ptr calendar(std::make_shared<NextFunctor::Calendar>(Base::compile(schedule)));
+            std::cout << *calendar << "\n";
+
+            ptime end(date(2018, moy::Jan, 1));
+            agree(*tree, *calendar, ptime(date(2016, moy::Jan, 1)), end);
+
+            //times before the horizon start it over
+            ptime t(date(2015, moy::Jun, 3), hours(7));
+            assert((*tree)(t, false) == (*calendar)(t, false));
+            assert((*tree)(t, true) == (*calendar)(t, true));
+
+            //follow the chain of occurrences like the scheduler does, the sparse ones for a few centuries
+            t = (*calendar)(end, false);
+            for(int i = 0; i < 1000 && t < ptime(date(2400, moy::Jan, 1)); ++i){
+                ptime next((*calendar)(t, true));
+                assert(next == (*tree)(t, true));
+                t = next;
+            }
+        }
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST occurrences ===\n\n";
+
+        f_ptr f(Base::parse("(WED & [13H|4H] & 5M)"));
+        std::cout << *f << "\n";
+
+        ptime d1(date(2016, moy::Aug, 31), hours(4) + minutes(5));
+        ptime d2(date(2016, moy::Sep, 14), hours(4) + minutes(5));
+        std::vector<ptime> window;
+        for(auto& t: f->occurrences(d1, d2)){
+            window.push_back(t);
+        }
+
+        const std::vector<ptime> expected {
+            d1,
+            ptime(date(2016, moy::Aug, 31), hours(13) + minutes(5)),
+            ptime(date(2016, moy::Sep, 7), hours(4) + minutes(5)),
+            ptime(date(2016, moy::Sep, 7), hours(13) + minutes(5))
+        };
+        assert(window == expected);
+
+        std::vector<ptime> next3;
+        for(auto& t: f->occurrences(d1, 3)){
+            next3.push_back(t);
+        }
+        assert(next3.size() == 3);
+        assert(std::equal(next3.begin(), next3.end(), expected.begin()));
+
+        //batches and all engines yield the chain of force_carry calls
+        const std::vector<std::string> schedules {"0M", "(WED & 13S & [(MAR & 12M) | JAN | (FRI & 17H)])", "[MON | 5M]",
+            "(29d & FEB & MON)", "[(31d & SUN & 23:59) | (TUE & 13:13) | (1d & [3H | 4H] & 30M)]",
+            "[(MON & 0:0) | (WED & [1H | 2H] & 7M) | ([JAN | DEC] & SAT & 5:5)]"};
+        for(auto& schedule: schedules){
+            f_ptr tree(Base::parse(schedule));
+            f_ptr compiled(Base::compile(schedule));
+            f_ptr calendar(std::make_shared<NextFunctor::Calendar>(Base::compile(schedule)));
+
+            ptime begin(date(2016, moy::Jan, 1), minutes(30) + microseconds(5));
+            ptime end(date(2017, moy::Jan, 1), time_duration(0,0,0,0));
+            std::vector<ptime> chain;
+            for(ptime t((*tree)(begin, false)); t < end; t = (*tree)(t, true)){
+                chain.push_back(t);
+            }
+
+            for(auto& engine: {tree, compiled, calendar}){
+                std::vector<ptime> filled;
+                for(auto& occurrence: engine->occurrences(begin, end)){
+                    filled.push_back(occurrence);
+                }
+                assert(filled == chain);
+            }
+            std::cout << schedule << ": " << chain.size() << " occurrences in 2016\n";
+        }
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST sparse and impossible conjunctions ===\n\n";
+
+        f_ptr f(Base::compile("(29d & FEB & MON)"));
+        std::cout << *f << "\n";
+
+        ptime t(date(2016, moy::Jan, 1), time_duration(0,0,0,0));
+        for(int i = 0; i < 5; ++i){
+            date expected(t.date().year() + (t.date().month() > moy::Feb || t.date().day() == 29), moy::Feb, 1);
+            while(!boost::gregorian::gregorian_calendar::is_leap_year(expected.year()) || date(expected.year(), moy::Feb, 29).day_of_week() != boost::date_time::Monday){
+                expected = date(expected.year() + 1, moy::Feb, 1);
+            }
+            t = (*f)(t, i > 0);
+            std::cout << "t: " << t << "\n";
+            assert(t == ptime(date(expected.year(), moy::Feb, 29), time_duration(0,0,0,0)));
+        }
+
+        f = Base::compile("(31d & SUN & 23:59)");
+        std::cout << *f << "\n";
+        ptime d1(date(2016, moy::Aug, 7), time_duration(0,0,0,0));
+        ptime d1r((*f)(d1, false));
+        std::cout << "d1: " << d1 << "\td1r:  " << d1r << "\n";
+        assert(d1r == ptime(date(2017, moy::Dec, 31), hours(23) + minutes(59)));
+        ptime d1rr((*f)(d1r, true));
+        std::cout << "d1: " << d1r << "\td1rr: " << d1rr << "\n";
+        assert(d1rr == ptime(date(2019, moy::Mar, 31), hours(23) + minutes(59)));
+
+        //a single day of month skips months which do not have it
+        f = Base::parse("31d");
+        ptime d2(date(2016, moy::Apr, 5), hours(3));
+        assert((*f)(d2, false) == ptime(date(2016, moy::May, 31), time_duration(0,0,0,0)));
+        ptime d3(date(2016, moy::Jan, 31), hours(3));
+        assert((*f)(d3, true) == ptime(date(2016, moy::Mar, 31), time_duration(0,0,0,0)));
+
+        //contradictions are rejected when parsing
+        assert(!Base::parse("(31d & FEB)"));
+        assert(!Base::parse("(30d & [FEB | (APR & 31d)])"));
+        assert(!Base::parse("[(3H & 4H) | (31d & FEB)]"));
+        assert(!Base::parse("(MON & [(3H & 4H) | (31d & FEB)])"));
+
+        //but a union is satisfiable as long as one of its branches is
+        f = Base::parse("[MON | (31d & FEB)]");
+        assert(f);
+        assert((*f)(d2, false) == ptime(date(2016, moy::Apr, 11), time_duration(0,0,0,0)));
+        assert(Base::parse("[MON | (3H & 4H)]"));
+        assert(!Base::compile("(MON & TUE)"));
+        assert(Base::parse("(29d & FEB)"));
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST solver (agrees with iterating the conditions) ===\n\n";
+
+        //the former evaluation of AllOf: apply every condition until nothing changes
+        auto fixpoint = [](const std::vector<f_ptr>& conditions, const ptime& from, bool force_carry){
+            ptime t = from;
+            if(force_carry){
+                t = boost::date_time::pos_infin;
+                for(auto& f: conditions){
+                    t = std::min(t, (*f)(from, true));
+                }
+            }
+            ptime begin;
+            while (t != begin){
+                begin = t;
+                for(auto& f: conditions){
+                    t = (*f)(t, false);
+                }
+            }
+            return t;
+        };
+
+        const std::vector<std::vector<std::string>> schedules {
+            {"8H", "37M"},
+            {"WED", "13S", "[(MAR & 12M) | JAN | (FRI & 17H)]"},
+            {"01:05", "[TUE | WED | THU | FRI | SAT]"},
+            {"[MON | 5M]", "[13H | 14H | 30S]"},
+            {"13d", "FRI"},
+            {"[JAN | 1d]", "[SUN | 0M]", "[5H | (MON & 7M)]"}
+        };
+
+        for(auto& conditions: schedules){
+            std::vector<f_ptr> parsed;
+            std::string schedule("(");
+            for(auto& condition: conditions){
+                parsed.push_back(Base::parse(condition));
+                schedule += (schedule.size() > 1 ? " & " : "") + condition;
+            }
+            schedule += ")";
+            f_ptr tree(Base::parse(schedule));
+            f_ptr compiled(Base::compile(schedule));
+            std::cout << *tree << "\n";
+
+            auto expected = [&](const ptime& from, bool force_carry){
+                return fixpoint(parsed, from, force_carry);
+            };
+            agree(*tree, expected, ptime(date(2016, moy::Jan, 1)), ptime(date(2017, moy::Jan, 1)));
+            agree(*compiled, expected, ptime(date(2016, moy::Jan, 1)), ptime(date(2017, moy::Jan, 1)));
+        }
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST schedule literals (agree with the parser) ===\n\n";
+        using namespace NextFunctor::Literals;
+
+        auto check = [](auto literal, const std::string& schedule){
+            f_ptr tree(Base::parse(schedule));
+            NextFunctor::Literal<decltype(literal)> wrapped(literal);
+            std::cout << wrapped << "\n";
+
+            std::ostringstream printed, parsed;
+            printed << wrapped;
+            parsed << *tree;
+            assert(printed.str() == parsed.str());
+
+            std::vector<NextFunctor::Instruction> code, tree_code;
+            wrapped.emit(code);
+            tree->emit(tree_code);
+            assert(code.size() == tree_code.size());
+            assert(wrapped.terms() == tree->terms());
+
+            agree(literal, *tree, ptime(date(2016, moy::Jan, 1)), ptime(date(2017, moy::Jan, 1)));
+        };
+
+        check("0M"_schedule, "0M");
+        check("18:30"_schedule, "18:30");
+        check("(8H & 37M)"_schedule, "(8H & 37M)");
+        check("(WED & 13S & [(MAR & 12M) | JAN | (FRI & 17H)])"_schedule, "(WED & 13S & [(MAR & 12M) | JAN | (FRI & 17H)])");
+        check("(01:05 & [TUE | WED | THU | FRI | SAT])"_schedule, "(01:05 & [TUE | WED | THU | FRI | SAT])");
+        check("[ MON|5M ]"_schedule, "[ MON|5M ]");
+        check("(31d & SUN & 23:59)"_schedule, "(31d & SUN & 23:59)");
+        check("[(JAN & 1d) | (29d & FEB) | 12S]"_schedule, "[(JAN & 1d) | (29d & FEB) | 12S]");
+        check("[MON | (31d & FEB)]"_schedule, "[MON | (31d & FEB)]");
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST cache (round trip of compiled schedules) ===\n\n";
+        std::vector<std::string> schedules{"0M", "18:30", "(WED & 13S & [(MAR & 12M) | JAN | (FRI & 17H)])",
+            "[(JAN & 1d) | (29d & FEB) | 12S]", "(31d & SUN & 23:59)"};
+        std::vector<std::pair<std::string, std::shared_ptr<NextFunctor::Compiled>>> compiled;
+        for(auto& schedule: schedules){
+            compiled.emplace_back(schedule, std::static_pointer_cast<NextFunctor::Compiled>(Base::compile(schedule)));
+        }
+
+        std::string path("/tmp/next_test.cache");
+        assert(NextFunctor::Cache::write(path, compiled));
+        NextFunctor::Cache cache(path);
+        assert(!cache.find("5M"));
+        for(auto& c: compiled){
+            std::shared_ptr<NextFunctor::Compiled> cached(cache.find(c.first));
+            assert(cached);
+            std::cout << *cached << "\n";
+            assert(cached->terms() == c.second->terms());
+            assert(cached->table() == c.second->table());
+
+            agree(*cached, *c.second, ptime(date(2016, moy::Jan, 1)), ptime(date(2017, moy::Jan, 1)));
+        }
+
+        // entries with out-of-range operands miss: "0M" is a single minute
+        // instruction, found in the file by its bytes
+        assert(NextFunctor::Cache::write(path, {compiled[0]}));
+        assert(NextFunctor::Cache(path).find("0M"));
+        {
+            NextFunctor::Instruction minute;
+            std::memset(&minute, 0, sizeof(minute));
+            minute.op = NextFunctor::Instruction::Op::minute;
+            minute.size = 1;
+            std::string bytes;
+            {
+                std::ifstream file(path, std::ios::binary);
+                bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            }
+            std::size_t at = bytes.find(std::string(reinterpret_cast<const char*>(&minute), sizeof(minute)));
+            assert(at != std::string::npos);
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(at + offsetof(NextFunctor::Instruction, value));
+            file.put(char(60));
+        }
+        NextFunctor::Cache damaged(path);
+        assert(!damaged.find("0M"));
+
+        // files of another format are ignored
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file << "not a cache";
+        }
+        NextFunctor::Cache foreign(path);
+        assert(!foreign.find("0M"));
+        std::remove(path.c_str());
+
+        std::cout << "OK\n\n";
+    }
+}
@@ -1,17 +1,42 @@
 #include <curl/curl.h>
 #include <libconfig.h++>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
-#include <fstream>
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 #include <queue>
 
 #include "next.h"
+#include "stream.h"
+#include "timer_wheel.h"
 
+#include <boost/date_time/c_local_time_adjustor.hpp>
 #include <boost/filesystem.hpp>
 
 class Programme {
@@ -19,35 +44,624 @@ public:
     const size_t station_id;
     const size_t programme_id;
     const std::string name;
+    const std::string schedule; //as configured, to tell changes apart on reload
     std::shared_ptr<NextFunctor::Base> next;
     const boost::posix_time::time_duration duration;
 
-    Programme(const size_t station_id, const size_t programme_id, const std::string& name, std::shared_ptr<NextFunctor::Base> next, const boost::posix_time::time_duration duration):
+    Programme(const size_t station_id, const size_t programme_id, const std::string& name, const std::string& schedule, std::shared_ptr<NextFunctor::Base> next, const boost::posix_time::time_duration duration):
         station_id(station_id),
         programme_id(programme_id),
         name(name),
+        schedule(schedule),
         next(next),
         duration(duration)
     {}
 };
 
+class PreRoll {
+    //the most recent seconds of a station's stream, so that recordings can begin at their
+    //scheduled time even if they are attached late. Only used by the Writer thread
+    struct Mark {
+        boost::posix_time::ptime received;
+        uint64_t begin; //stream offset of the chunk
+        uint64_t frame; //stream offset of the first frame starting in it, `none` if none does
+    };
+    static const uint64_t none = ~uint64_t(0);
+
+    const boost::posix_time::time_duration window;
+    std::vector<char> buffer;
+    std::vector<Mark> marks;
+    size_t marks_begin;
+    size_t marks_count;
+    uint64_t end; //stream offset after the last byte
+
+public:
+    //enough for 320 kbit/s, pieces of a stream arrive way less often than 100 times a second
+    static const size_t bytes_per_second = 40 * 1024;
+    static const size_t marks_per_second = 100;
+
+    explicit PreRoll(long seconds):
+        window(boost::posix_time::seconds(seconds)),
+        buffer(seconds * bytes_per_second),
+        marks(seconds * marks_per_second),
+        marks_begin(0),
+        marks_count(0),
+        end(0)
+    {}
+
+    void append(const Chunk& chunk, const boost::posix_time::ptime& received){
+        for(size_t copied = 0; copied < chunk.size; ){
+            size_t offset = (end + copied) % buffer.size();
+            size_t length = std::min(chunk.size - copied, buffer.size() - offset);
+            std::memcpy(buffer.data() + offset, chunk.data + copied, length);
+            copied += length;
+        }
+
+        if(marks_count == marks.size()){
+            marks_begin = (marks_begin + 1) % marks.size();
+            --marks_count;
+        }
+        marks[(marks_begin + marks_count++) % marks.size()] = Mark{received, end, chunk.frame < chunk.size ? end + chunk.frame : none};
+        end += chunk.size;
+
+        //forget what has been overwritten or is too old
+        while(marks_count > 0){
+            const Mark& oldest = marks[marks_begin];
+            if(oldest.begin + buffer.size() >= end && oldest.received + window >= received){
+                break;
+            }
+            marks_begin = (marks_begin + 1) % marks.size();
+            --marks_count;
+        }
+    }
+
+    size_t since(const boost::posix_time::ptime& from, iovec iov[2], boost::posix_time::ptime* received = nullptr) const {
+        //the data from the first frame received at or after `from`, as up to two pieces. `received`
+        //is set to the time that frame arrived
+        uint64_t begin = none;
+        for(size_t i = 0; i < marks_count && begin == none; ++i){
+            const Mark& mark = marks[(marks_begin + i) % marks.size()];
+            if(mark.received >= from){
+                begin = mark.frame;
+                if(received){
+                    *received = mark.received;
+                }
+            }
+        }
+        if(begin == none){
+            return 0;
+        }
+
+        size_t count = 0;
+        for(uint64_t position = begin; position < end; ++count){
+            size_t offset = position % buffer.size();
+            size_t length = std::min<uint64_t>(end - position, buffer.size() - offset);
+            iov[count].iov_base = const_cast<char*>(buffer.data() + offset);
+            iov[count].iov_len = length;
+            position += length;
+        }
+        return count;
+    }
+};
+
+const uint64_t PreRoll::none;
+const size_t PreRoll::bytes_per_second;
+const size_t PreRoll::marks_per_second;
+
+class Counter {
+    //updated by a single thread and read by any, so it takes no locked instruction
+    std::atomic<uint64_t> value;
+
+public:
+    Counter():
+        value(0)
+    {}
+
+    void add(uint64_t amount){
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    void set(uint64_t amount){
+        value.store(amount, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+class Histogram {
+    //observations counted into fixed buckets by a single thread, read by any
+    const std::vector<double> bounds; //upper bounds, ascending
+    std::unique_ptr<Counter[]> counts; //per bucket and one more above the last bound
+    std::atomic<double> total;
+
+public:
+    explicit Histogram(std::initializer_list<double> bounds):
+        bounds(bounds),
+        counts(new Counter[bounds.size() + 1]),
+        total(0)
+    {}
+
+    void observe(double value){
+        size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+        counts[bucket].add(1);
+        total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void print(std::ostream& out, const std::string& name, const std::string& labels) const {
+        //in the Prometheus text format, the buckets are cumulative
+        uint64_t cumulative = 0;
+        for(size_t i = 0; i <= bounds.size(); ++i){
+            cumulative += counts[i].get();
+            out << name << "_bucket{" << labels << ",le=\"";
+            if(i < bounds.size()){
+                out << bounds[i];
+            }
+            else {
+                out << "+Inf";
+            }
+            out << "\"} " << cumulative << "\n";
+        }
+        out << name << "_sum{" << labels << "} " << total.load(std::memory_order_relaxed) << "\n";
+        out << name << "_count{" << labels << "} " << cumulative << "\n";
+    }
+};
+
+class Quantiles {
+    //the latest observations of a single thread, whose quantiles are read by any
+    const size_t capacity;
+    std::unique_ptr<std::atomic<double>[]> recent; //a ring, the slot is the count modulo capacity
+    Counter count;
+    std::atomic<double> total;
+
+public:
+    explicit Quantiles(size_t capacity):
+        capacity(capacity),
+        recent(new std::atomic<double>[capacity]()),
+        count(),
+        total(0)
+    {}
+
+    void observe(double value){
+        recent[count.get() % capacity].store(value, std::memory_order_relaxed);
+        count.add(1);
+        total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void print(std::ostream& out, const std::string& name, const std::string& labels) const {
+        //in the Prometheus text format as a summary, the quantiles by nearest rank
+        uint64_t observed = count.get();
+        std::vector<double> values;
+        for(size_t i = 0; i < std::min<uint64_t>(observed, capacity); ++i){
+            values.push_back(recent[i].load(std::memory_order_relaxed));
+        }
+        std::sort(values.begin(), values.end());
+        for(double quantile: {0.5, 0.9, 0.99, 1.0}){
+            out << name << "{" << labels << ",quantile=\"" << quantile << "\"} ";
+            if(values.empty()){
+                out << "NaN\n";
+                continue;
+            }
+            size_t rank = static_cast<size_t>(std::ceil(quantile * values.size()));
+            out << values[std::max<size_t>(rank, 1) - 1] << "\n";
+        }
+        out << name << "_sum{" << labels << "} " << total.load(std::memory_order_relaxed) << "\n";
+        out << name << "_count{" << labels << "} " << observed << "\n";
+    }
+};
+
+struct StationMetrics {
+    //kept by the threads handling the station, each value by one of them only
+    //Downloader thread
+    Counter received_bytes;
+    Counter reconnects;
+    Histogram stall_seconds{1, 2, 5, 10, 30, 60, 300};
+    //Writer thread
+    Counter written_bytes;
+    Counter recordings;
+    Counter sinks;
+    Counter byte_rate; //bytes per second, 0 until measured
+    Histogram write_seconds{0.0001, 0.001, 0.01, 0.1, 1, 10};
+    Histogram start_delay_seconds{0.1, 0.5, 1, 2, 5, 10, 30, 60};
+    Quantiles start_skew_seconds{256};
+};
+
+class Segments {
+    //HLS output of a recording: cut into segments of about `target` at frame boundaries and listed in a
+    //playlist which grows with them, so that recordings in progress can be served as static files.
+    //Segments are timed by the reception of their first frame, which keeps pace with a live stream
+    std::string directory;
+    std::string extension;
+    boost::posix_time::time_duration target;
+    int destination; //the current segment, -1 until it is opened or if that failed
+    size_t sequence; //of the current segment
+    std::string playlist; //entries of the completed segments
+    long target_seconds;
+    //the Writer cuts the segments when it assigns the data to the sinks and writes them later
+    boost::posix_time::ptime begun; //first frame of the segment being assigned
+    boost::posix_time::ptime last; //last data assigned
+    std::deque<double> cut_seconds; //of segments cut but not written completely
+
+    std::string segment_name() const {
+        char number[24];
+        std::snprintf(number, sizeof(number), "%05zu.", sequence);
+        return number + extension;
+    }
+
+    void publish(bool complete){
+        //replaces the playlist at once so that it is never served half written
+        std::string path = directory + "/index.m3u8";
+        std::string temporary = path + ".tmp";
+        std::ofstream out(temporary, std::ios::trunc);
+        out << "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:" << target_seconds
+            << "\n#EXT-X-MEDIA-SEQUENCE:0\n#EXT-X-PLAYLIST-TYPE:EVENT\n"
+            << playlist << (complete ? "#EXT-X-ENDLIST\n" : "");
+        out.close();
+        if(!out || std::rename(temporary.c_str(), path.c_str()) != 0){
+            std::cout << "[ERR] writing " << path << " failed: " << std::strerror(errno) << std::endl;
+        }
+    }
+
+    void complete(double seconds){
+        //closes the current segment and lists it if anything has been written to it
+        if(destination < 0){
+            return;
+        }
+        close(destination);
+        destination = -1;
+        target_seconds = std::max(target_seconds, static_cast<long>(std::ceil(seconds)));
+        std::ostringstream entry;
+        entry << std::fixed << std::setprecision(3) << "#EXTINF:" << seconds << ",\n" << segment_name() << "\n";
+        playlist += entry.str();
+    }
+
+public:
+    Segments(const std::string& directory, const std::string& extension, const boost::posix_time::time_duration& target):
+        directory(directory),
+        extension(extension),
+        target(target),
+        destination(-1),
+        sequence(0),
+        playlist(),
+        target_seconds(std::max<long>(target.total_seconds(), 1)),
+        begun(boost::posix_time::not_a_date_time),
+        last(boost::posix_time::not_a_date_time),
+        cut_seconds()
+    {}
+    Segments(const Segments&) = delete;
+    Segments& operator=(const Segments&) = delete;
+    ~Segments(){
+        if(destination >= 0){
+            close(destination);
+        }
+    }
+
+    bool assign(const boost::posix_time::ptime& received){
+        //called for every piece of data assigned to the recording, true if a segment
+        //should end at the next frame boundary
+        if(begun.is_not_a_date_time()){
+            begun = received;
+        }
+        last = received;
+        return received - begun >= target;
+    }
+
+    void cut(const boost::posix_time::ptime& received){
+        //the segment being assigned ends at a frame of the data received at `received`
+        cut_seconds.push_back((received - begun).total_microseconds() / 1e6);
+        begun = received;
+    }
+
+    void write(iovec* iov, size_t count){
+        //appends to the current segment, which is opened with its first data
+        if(count == 0){
+            return;
+        }
+        if(destination < 0){
+            std::string path = directory + "/" + segment_name();
+            destination = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if(destination < 0){
+                std::cout << "[ERR] " << path << ": " << std::strerror(errno) << std::endl;
+                return;
+            }
+        }
+        while(count > 0){
+            ssize_t done = writev(destination, iov, count);
+            if(done < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                std::cout << "[ERR] writing a segment failed: " << std::strerror(errno) << std::endl;
+                return;
+            }
+            while(count > 0 && static_cast<size_t>(done) >= iov->iov_len){
+                done -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if(count > 0){
+                iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+                iov->iov_len -= done;
+            }
+        }
+    }
+
+    void next(){
+        //the data written from now on belongs to the next segment
+        complete(cut_seconds.front());
+        cut_seconds.pop_front();
+        ++sequence;
+        publish(false);
+    }
+
+    void finish(){
+        //the recording has ended
+        if(!last.is_not_a_date_time()){
+            complete((last - begun).total_microseconds() / 1e6);
+        }
+        publish(true);
+    }
+};
+
 class Sink{
+    boost::posix_time::ptime valid_from;
     boost::posix_time::ptime valid_until;
-    std::unique_ptr<std::ofstream> destination;
+    int destination;
+    //the file is preallocated up to `allocated` beyond its size, which only grows as data is
+    //written: a recording interrupted by a crash holds what has been written and no more
+    off_t offset;
+    off_t allocated;
+    //recordings start and end at frame boundaries
+    bool started;
+    bool finished;
+    bool written; //anything, for the delay of the recording's start
+    //parts of chunks shared with the other sinks of the station, written at once with pwritev
+    struct Piece {
+        Chunk* chunk;
+        size_t begin;
+        size_t end;
+        size_t cut; //where the next HLS segment begins, `end` if it does not
+    };
+    std::vector<Piece> pending;
+    size_t pending_bytes;
+    uint64_t length; //of the recording including what is pending
+    std::unique_ptr<Segments> segments; //optional HLS output
+    //the titles of the ICY metadata with their offsets, opened with the first one
+    std::string titles_path;
+    int titles;
+    //a recording lying within another one of the station is not written itself but copied from the
+    //other's file once it is complete, sharing the extents where the file system supports it
+    uint64_t serial; //among the sinks of the station
+    uint64_t host; //serial of the sink recording this one's data, 0 if none
+    int source; //the host's file
+    off_t source_offset; //of this recording's beginning in `source`
+    uint64_t base; //length of the file when it has been opened
+    uint64_t first; //position of the first byte in the stream, once started
 public:
-    Sink(const boost::posix_time::ptime& valid_until, std::unique_ptr<std::ofstream>&& destination):
+    //write at most this many pieces at once (IOV_MAX), the amount of data is up to the station.
+    //Data is not kept for longer than the delay unless the sink expires
+    static const size_t batch_chunks = 1024;
+    static const long batch_delay_ms = 1000;
+    //recordings within others are copied this many bytes at a time, so that a long one does not
+    //keep the Writer from draining its other stations
+    static const uint64_t copy_slice = 4 * 1024 * 1024;
+
+    Sink(const boost::posix_time::ptime& valid_from, const boost::posix_time::ptime& valid_until, int destination, std::unique_ptr<Segments> segments, const std::string& titles_path):
+        valid_from(valid_from),
         valid_until(valid_until),
-        destination(std::move(destination))
+        destination(destination),
+        offset(destination >= 0 ? lseek(destination, 0, SEEK_END) : 0),
+        allocated(0),
+        started(false),
+        finished(false),
+        written(false),
+        pending(),
+        pending_bytes(0),
+        length(offset),
+        segments(std::move(segments)),
+        titles_path(titles_path),
+        titles(-1),
+        serial(0),
+        host(0),
+        source(-1),
+        source_offset(0),
+        base(offset),
+        first(0)
     {}
     Sink(Sink&& sink):
+        valid_from(sink.valid_from),
         valid_until(sink.valid_until),
-        destination(std::move(sink.destination))
-    {}
-    Sink& operator=(Sink&& sink) = default;
+        destination(sink.destination),
+        offset(sink.offset),
+        allocated(sink.allocated),
+        started(sink.started),
+        finished(sink.finished),
+        written(sink.written),
+        pending(std::move(sink.pending)),
+        pending_bytes(sink.pending_bytes),
+        length(sink.length),
+        segments(std::move(sink.segments)),
+        titles_path(std::move(sink.titles_path)),
+        titles(sink.titles),
+        serial(sink.serial),
+        host(sink.host),
+        source(sink.source),
+        source_offset(sink.source_offset),
+        base(sink.base),
+        first(sink.first)
+    {
+        sink.destination = -1;
+        sink.titles = -1;
+        sink.source = -1;
+        sink.pending.clear();
+    }
+    Sink& operator=(Sink&& sink){
+        std::swap(valid_from, sink.valid_from);
+        std::swap(valid_until, sink.valid_until);
+        std::swap(destination, sink.destination);
+        std::swap(offset, sink.offset);
+        std::swap(allocated, sink.allocated);
+        std::swap(started, sink.started);
+        std::swap(finished, sink.finished);
+        std::swap(written, sink.written);
+        std::swap(pending, sink.pending);
+        std::swap(pending_bytes, sink.pending_bytes);
+        std::swap(length, sink.length);
+        std::swap(segments, sink.segments);
+        std::swap(titles_path, sink.titles_path);
+        std::swap(titles, sink.titles);
+        std::swap(serial, sink.serial);
+        std::swap(host, sink.host);
+        std::swap(source, sink.source);
+        std::swap(source_offset, sink.source_offset);
+        std::swap(base, sink.base);
+        std::swap(first, sink.first);
+        return *this;
+    }
     Sink operator=(const Sink& sink) = delete;
+    ~Sink(){
+        //the owner has to flush the pending chunks beforehand
+        if(destination >= 0){
+            //give back what has been preallocated in vain. `offset` is the size of the file already,
+            //truncating to it only releases the blocks reserved beyond (punching a hole does not)
+            if(allocated > offset && ftruncate(destination, offset) < 0){
+                std::cout << "[ERR] releasing the space of a recording failed: " << std::strerror(errno) << std::endl;
+            }
+            close(destination);
+        }
+        if(titles >= 0){
+            close(titles);
+        }
+        if(source >= 0){
+            close(source);
+        }
+    }
+
+    bool within(const Sink& other) const {
+        //whether this recording can be copied from `other` once it is complete
+        return other.host == 0 && other.destination >= 0 && other.valid_from <= valid_from && valid_until <= other.valid_until
+            && (!started || (other.started && other.first <= first));
+    }
+
+    void share(const Sink& other){
+        //the data of this recording will be copied from `other`, which is within()
+        source = dup(other.destination);
+        if(source >= 0){
+            host = other.serial;
+        }
+    }
+
+    void begin(uint64_t position, const Sink* other){
+        //the recording starts at `position` of the stream, which `other` holds if it is the host
+        first = position;
+        if(host != 0 && other != nullptr && other->started && other->first <= first){
+            source_offset = other->base + (first - other->first);
+        }
+        else if(host != 0){
+            //nothing to copy from, it is recorded by itself after all
+            close(source);
+            source = -1;
+            host = 0;
+        }
+    }
+
+    uint64_t uncopied() const {
+        //bytes of a recording within another one which are still to be copied
+        return length - offset;
+    }
+
+    bool copy(uint64_t limit){
+        //copies up to `limit` more bytes of the recording from the host's file, in the kernel.
+        //false and errno on failure
+        uint64_t size = std::min(uncopied(), limit);
+        off_t from = source_offset + (offset - base);
+        while(size > 0){
+            ssize_t done = copy_file_range(source, &from, destination, &offset, size, 0);
+            if(done < 0 && errno == EINTR){
+                continue;
+            }
+            if(done < 0 && (errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP || errno == EINVAL)){
+                //not between these files, through user space then
+                char buffer[64 * 1024];
+                done = pread(source, buffer, std::min<uint64_t>(size, sizeof(buffer)), from);
+                if(done > 0){
+                    done = pwrite(destination, buffer, done, offset);
+                    from += std::max<ssize_t>(done, 0);
+                    offset += std::max<ssize_t>(done, 0);
+                }
+            }
+            if(done <= 0){
+                if(done == 0){
+                    errno = EIO; //the host is shorter than it should be
+                }
+                return false;
+            }
+            size -= done;
+        }
+        return true;
+    }
+
+    void title(uint64_t at, const boost::posix_time::ptime& when, const std::string& text){
+        //notes that `text` is played from byte `at` of the recording on, one tab separated line each
+        if(titles < 0){
+            if(titles_path.empty()){
+                //opening it failed before
+                return;
+            }
+            titles = open(titles_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if(titles < 0){
+                std::cout << "[ERR] " << titles_path << ": " << std::strerror(errno) << std::endl;
+                titles_path.clear();
+                return;
+            }
+        }
+        std::string line = boost::posix_time::to_iso_extended_string(when) + "\t" + std::to_string(at) + "\t" + text + "\n";
+        if(::write(titles, line.data(), line.size()) != static_cast<ssize_t>(line.size())){
+            std::cout << "[ERR] writing " << titles_path << " failed: " << std::strerror(errno) << std::endl;
+        }
+    }
+
+    void preallocate(off_t length){
+        //reserves `length` more bytes in one piece without changing the size of the file
+        if(length > 0 && fallocate(destination, FALLOC_FL_KEEP_SIZE, offset, length) == 0){
+            allocated = offset + length;
+        }
+    }
+
+    bool write(iovec* iov, size_t count){
+        //writes all of `iov`, which is modified. false and errno on failure
+        while(count > 0){
+            ssize_t done = pwritev(destination, iov, count, offset);
+            if(done < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                return false;
+            }
+            offset += done;
+            //skip what has been written completely, then advance within the next piece
+            while(count > 0 && static_cast<size_t>(done) >= iov->iov_len){
+                done -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if(count > 0){
+                iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+                iov->iov_len -= done;
+            }
+        }
+        return true;
+    }
     friend class Station;
 };
 
+const size_t Sink::batch_chunks;
+const long Sink::batch_delay_ms;
+const uint64_t Sink::copy_slice;
+
+class Downloader;
+
 class Station {
 public:
     enum class Strategy { direct, m3u, pls };
@@ -59,62 +673,658 @@ public:
     const Strategy strategy;
     const long timeout_direct;
     const long timeout_playlist;
+    const long playlist_cache;
+    const size_t write_buffer; //bytes written to a recording at once
+    StationMetrics metrics;
+
+    //entries of the playlist tried at once once the one which worked last fails
+    static const size_t race_width = 4;
 private:
-//owned and (predominantly) managed by the cURL thread
-//make sure to acquire the mutex before accessing `sinks`
+//handed over from the scheduling thread to the Writer thread
+//make sure to acquire the mutex before accessing `attached`
     std::unique_ptr<std::mutex> sinks_mutex;
+    std::vector<Sink> attached;
+//owned by the Writer thread draining this station's ring
     std::vector<Sink> sinks;
-    boost::posix_time::ptime last_progress_time;
-    curl_off_t last_progress_bytes;
-//owned by the main/schedule management thread
-    std::thread thread;
+    std::deque<Sink> copies; //finished recordings within others, copied a slice per drain()
+    std::unique_ptr<Framer> framer;
+    std::unique_ptr<PreRoll> preroll;
+    std::unique_ptr<Merger> merger; //of redundant links
+    int writer_event_fd;
+    //bitrate of the stream measured over a minute, recordings are preallocated by it
+    std::chrono::system_clock::time_point rate_since;
+    size_t rate_bytes;
+    double byte_rate; //bytes per second, 0 until measured
+    std::string title; //of the ICY metadata, as far as the stream has been recorded
+    uint64_t position; //in the stream of the next byte recorded
+    uint64_t sink_serial; //of the sink added last
+//shared between the Downloader and the Writer thread
+    std::unique_ptr<ChunkRing> ring;
+//owned by the Downloader thread driving this station's transfers
+    Downloader* downloader;
+    bool connected;
+    //independent connections to the stream, more than one for redundancy
+    struct Link {
+        CURL* transfer; //delivering the stream, nullptr until an attempt delivers
+        boost::posix_time::ptime paused_since;
+        bool overflowing;
+        bool reconnected;
+        bool racing;
+        bool waiting; //for the playlist
+        size_t url_index; //of the entry which delivered last
+    };
+    std::vector<Link> links;
+    //transfers of the stream, several race for a link until one of them delivers
+    struct Attempt {
+        Station* station;
+        size_t link;
+        CURL* easyhandle;
+        size_t url_index;
+        boost::posix_time::ptime last_progress_time;
+        curl_off_t last_progress_bytes;
+        IcyDemuxer icy;
+    };
+    std::vector<std::unique_ptr<Attempt>> attempts;
+    CURL* playlist_transfer;
+    std::string playlist;
+    std::vector<std::string> urls;
+    boost::posix_time::ptime resolved; //when `urls` have been fetched
+
+    friend class Downloader;
+    friend class Writer;
 
 public:
-    void spawn(){
-        if(strategy == Strategy::direct){
-            this->thread = std::thread(&Station::download_direct_loop, this, original_url); //.detach();
+    void connect(CURLM* multi){
+        //called by the Downloader thread to start receiving the stream
+        if(connected){
+            return;
         }
-        else {
-            this->thread = std::thread(&Station::download_playlist_loop, this, original_url); //.detach();
+        connected = true;
+        for(size_t link = 0; link < links.size(); ++link){
+            reconnect(multi, link, true);
+        }
+    }
+
+    void disconnect(CURLM* multi){
+        //called by the Downloader thread to stop receiving the stream
+        if(!connected){
+            return;
+        }
+        connected = false;
+        for(auto& attempt: attempts){
+            curl_multi_remove_handle(multi, attempt->easyhandle);
+            curl_easy_cleanup(attempt->easyhandle);
+        }
+        attempts.clear();
+        if(playlist_transfer != nullptr){
+            curl_multi_remove_handle(multi, playlist_transfer);
+            curl_easy_cleanup(playlist_transfer);
+            playlist_transfer = nullptr;
+        }
+        for(auto& link: links){
+            link.transfer = nullptr;
+            link.paused_since = boost::posix_time::not_a_date_time;
+            link.waiting = false;
+        }
+        std::cout << "[OK ] " << std::left << std::setw(8) << name << " disconnected" << std::endl;
+    }
+
+    void done(CURLM* multi, CURL* easyhandle, CURLcode success){
+        //called by the Downloader thread when a transfer of this station has finished
+        curl_multi_remove_handle(multi, easyhandle);
+        curl_easy_cleanup(easyhandle);
+        if(easyhandle == playlist_transfer){
+            playlist_transfer = nullptr;
+            if(connected){
+                playlist_fetched(multi, success);
+            }
+            return;
+        }
+
+        auto attempt = std::find_if(attempts.begin(), attempts.end(), [easyhandle](const std::unique_ptr<Attempt>& attempt){return attempt->easyhandle == easyhandle;});
+        if(attempt == attempts.end()){
+            return;
+        }
+        size_t index = (*attempt)->link;
+        attempts.erase(attempt);
+        Link& link = links[index];
+        bool current = easyhandle == link.transfer;
+        if(current){
+            link.transfer = nullptr;
+            link.paused_since = boost::posix_time::not_a_date_time;
+        }
+        if(!connected){
+            return;
+        }
+        if(link.transfer != nullptr || std::any_of(attempts.begin(), attempts.end(), [index](const std::unique_ptr<Attempt>& attempt){return attempt->link == index;})){
+            //lost a race, or others are still trying
+            return;
+        }
+
+        std::cout << "[ERR] " << std::left << std::setw(8) << name << " " << curl_easy_strerror(success);
+        if(links.size() > 1){
+            std::cout << " on link " << index;
+        }
+        std::cout << std::endl;
+        metrics.reconnects.add(1);
+        reconnect(multi, index, current);
+    }
+
+    void resume(){
+        //called by the Downloader thread once the Writer made room in the ring
+        for(auto& link: links){
+            resume(link);
+        }
+    }
+
+    void check_paused(const boost::posix_time::ptime& now){
+        //called by the Downloader thread. If the Writer keeps the transfer waiting for too long, continue
+        //receiving and discard what does not fit into the ring, rather than being dropped by the server
+        for(auto& link: links){
+            if(link.transfer != nullptr && !link.paused_since.is_not_a_date_time() && now - link.paused_since > boost::posix_time::seconds(timeout_direct)){
+                link.overflowing = true;
+                resume(link);
+            }
+        }
+    }
+
+    bool drain(){
+        //called by the Writer thread, hands what has been received so far to the sinks, which
+        //write it in batches. returns true if the transfer was paused for want of room and may continue
+        std::vector<Sink> added;
+        {
+            std::lock_guard<std::mutex> lock(*sinks_mutex);
+            added.swap(attached);
+        }
+        //the longest of the recordings starting at the same time first, the others may lie within it
+        std::sort(added.begin(), added.end(), [](const Sink& a, const Sink& b){
+            return a.valid_from < b.valid_from || (a.valid_from == b.valid_from && a.valid_until > b.valid_until);
+        });
+        for(auto& sink: added){
+            sink.serial = ++sink_serial;
+            if(!sink.segments && sink.destination >= 0){
+                for(auto& other: sinks){
+                    if(sink.within(other)){
+                        sink.share(other);
+                        break;
+                    }
+                }
+            }
+
+            //begin with what has been received since the sink's start already
+            iovec iov[2];
+            boost::posix_time::ptime received;
+            size_t count = preroll ? preroll->since(sink.valid_from, iov, &received) : 0;
+            size_t bytes = 0;
+            for(size_t i = 0; i < count; ++i){
+                bytes += iov[i].iov_len;
+            }
+            if(count > 0){
+                sink.started = true;
+                sink.begin(position - bytes, hosting(sink));
+                skew(sink, received);
+            }
+            if(sink.host == 0){
+                sink.preallocate(estimate(sink));
+            }
+            if(count > 0){
+                if(!title.empty()){
+                    sink.title(sink.length, sink.valid_from, title);
+                }
+                sink.length += bytes;
+                if(sink.host == 0){
+                    write_sink(sink, iov, count);
+                }
+                if(sink.segments){
+                    sink.segments->assign(sink.valid_from);
+                    sink.segments->write(iov, preroll->since(sink.valid_from, iov));
+                }
+            }
+            sinks.emplace_back(std::move(sink));
+            metrics.recordings.add(1);
+        }
+
+        //only what is there already, so a fast stream cannot starve the others
+        std::vector<Chunk*> recorded;
+        for(size_t n = ring->size(); n > 0; --n){
+            Chunk* chunk = ring->pop();
+            if(merger){
+                merger->take(chunk, recorded, name.c_str());
+            }
+            else {
+                recorded.push_back(chunk);
+            }
+        }
+        if(merger){
+            merger->check(std::chrono::system_clock::now(), recorded, name.c_str());
+        }
+
+        for(auto chunk: recorded){
+            measure(*chunk);
+            chunk->frame = framer->feed(chunk->data, chunk->size, chunk->discontinuity);
+            boost::posix_time::ptime received(boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(
+                boost::posix_time::from_time_t(0) + boost::posix_time::microseconds(
+                    std::chrono::duration_cast<std::chrono::microseconds>(chunk->received.time_since_epoch()).count())));
+
+            if(preroll){
+                preroll->append(*chunk, received);
+            }
+
+            //all of the sinks share the chunk, from their first frame received after they
+            //started until the end of the last frame begun before they expired
+            for(auto& sink: sinks){
+                size_t begin = sink.started ? 0 : sink.valid_from <= received ? chunk->frame : chunk->size;
+                size_t end = chunk->size;
+                bool starting = !sink.started && begin < end;
+                sink.started = sink.started || begin < end;
+                if(sink.valid_until < received){
+                    //unless that frame takes unusually long
+                    end = sink.valid_until + boost::posix_time::seconds(1) < received ? 0 : chunk->frame;
+                    sink.finished = end < chunk->size;
+                }
+                if(starting){
+                    sink.begin(position + begin, hosting(sink));
+                    skew(sink, received);
+                }
+
+                //the title played at the start, then those beginning within the recording
+                if(starting && !title.empty() && !(chunk->titled && chunk->title_offset <= begin)){
+                    sink.title(sink.length, received, title);
+                }
+                if(chunk->titled && sink.started && chunk->title_offset <= end && !(sink.finished && chunk->title_offset == end)){
+                    sink.title(sink.length + std::max(chunk->title_offset, begin) - begin, received, chunk->title);
+                }
+
+                if(begin < end && sink.host == 0){
+                    size_t cut = end;
+                    if(sink.segments && sink.segments->assign(received) && begin <= chunk->frame && chunk->frame < end){
+                        sink.segments->cut(received);
+                        cut = chunk->frame;
+                    }
+                    sink.pending.push_back(Sink::Piece{chunk, begin, end, cut});
+                    sink.pending_bytes += end - begin;
+                    ++chunk->references;
+                }
+                sink.length += end - begin;
+                if(sink.host != 0){
+                    //copied once the host has received all of it
+                    continue;
+                }
+                if(sink.finished || sink.pending_bytes >= write_buffer || sink.pending.size() >= std::min(Sink::batch_chunks, ring->capacity() / 2)){
+                    flush(sink);
+                }
+            }
+            for(auto& sink: sinks){
+                if(sink.host != 0 && sink.finished){
+                    flush(sink);
+                }
+            }
+            position += chunk->size;
+            if(chunk->titled){
+                title = chunk->title;
+            }
+            if(chunk->references == 0){
+                ring->release(chunk);
+            }
+
+            //erase expired sinks
+            sinks.erase(std::remove_if(sinks.begin(), sinks.end(), [](const Sink& sink){return sink.finished;}), sinks.end());
+        }
+
+        //sinks also expire when nothing is received anymore
+        boost::posix_time::ptime now(boost::posix_time::microsec_clock::local_time());
+        for(auto& sink: sinks){
+            if(sink.valid_until + boost::posix_time::seconds(1) < now){
+                sink.finished = true;
+                flush(sink);
+            }
+        }
+        sinks.erase(std::remove_if(sinks.begin(), sinks.end(), [](const Sink& sink){return sink.finished;}), sinks.end());
+        metrics.sinks.set(sinks.size());
+
+        //do not keep data for long, nor when the Downloader waits for chunks
+        auto old = std::chrono::system_clock::now() - std::chrono::milliseconds(Sink::batch_delay_ms);
+        bool waiting = ring->paused.load();
+        for(auto& sink: sinks){
+            if(!sink.pending.empty() && (waiting || sink.pending.front().chunk->received < old)){
+                flush(sink);
+            }
+        }
+
+        copy(Sink::copy_slice);
+
+        if(ring->paused.exchange(false)){
+            //log the 1st, 2nd, 4th, 8th, ... time only
+            unsigned long long pauses = ring->pauses;
+            if((pauses & (pauses - 1)) == 0){
+                std::cout << "[ERR] " << std::left << std::setw(8) << name << " writing fell behind, receiving paused " << pauses
+                    << " times, " << ring->overflow_bytes << " bytes discarded" << std::endl;
+            }
+            return true;
         }
+        return false;
+    }
+
+    bool drained() const {
+        return ring->size() == 0 && copies.empty();
+    }
+
+    void copy(uint64_t limit){
+        //called by the Writer thread, copies up to `limit` bytes of the recordings within others
+        while(limit > 0 && !copies.empty()){
+            Sink& sink = copies.front();
+            uint64_t before = sink.uncopied();
+            bool copied = sink.copy(limit);
+            if(!copied){
+                std::cout << "[ERR] " << std::left << std::setw(8) << name << " copying a recording failed: " << std::strerror(errno) << std::endl;
+            }
+            limit -= std::min(limit, before - sink.uncopied());
+            if(!copied || sink.uncopied() == 0){
+                copies.pop_front();
+            }
+        }
+    }
+
+    Sink* hosting(const Sink& sink){
+        //the sink recording the data of `sink`, if it is still there
+        for(auto& other: sinks){
+            if(sink.host != 0 && other.serial == sink.host){
+                return &other;
+            }
+        }
+        return nullptr;
+    }
+
+    void flush(Sink& sink){
+        //called by the Writer thread, writes the pending chunks of `sink` and releases them
+        if(sink.host != 0){
+            //a recording within another one is copied from its file once complete
+            if(sink.finished){
+                Sink* host = hosting(sink);
+                if(host != nullptr){
+                    flush(*host);
+                }
+                copies.emplace_back(std::move(sink));
+                sink.host = 0;
+            }
+            return;
+        }
+        iovec iov[Sink::batch_chunks];
+        size_t count = 0;
+        for(auto& piece: sink.pending){
+            iov[count].iov_base = piece.chunk->data + piece.begin;
+            iov[count].iov_len = piece.end - piece.begin;
+            ++count;
+        }
+
+        write_sink(sink, iov, count);
+
+        if(sink.segments){
+            //the same data once more, into as many segments as it spans
+            count = 0;
+            for(auto& piece: sink.pending){
+                size_t begin = piece.begin;
+                if(piece.cut < piece.end){
+                    if(begin < piece.cut){
+                        iov[count].iov_base = piece.chunk->data + begin;
+                        iov[count].iov_len = piece.cut - begin;
+                        ++count;
+                    }
+                    sink.segments->write(iov, count);
+                    sink.segments->next();
+                    count = 0;
+                    begin = piece.cut;
+                }
+                iov[count].iov_base = piece.chunk->data + begin;
+                iov[count].iov_len = piece.end - begin;
+                ++count;
+            }
+            sink.segments->write(iov, count);
+            if(sink.finished){
+                sink.segments->finish();
+            }
+        }
+
+        for(auto& piece: sink.pending){
+            if(--piece.chunk->references == 0){
+                ring->release(piece.chunk);
+            }
+        }
+        sink.pending.clear();
+        sink.pending_bytes = 0;
+    }
+
+    void write_sink(Sink& sink, iovec* iov, size_t count){
+        //called by the Writer thread, keeps track of the amount written and of how long it took
+        size_t bytes = 0;
+        for(size_t i = 0; i < count; ++i){
+            bytes += iov[i].iov_len;
+        }
+        auto begin = std::chrono::steady_clock::now();
+        if(!sink.write(iov, count)){
+            std::cout << "[ERR] " << std::left << std::setw(8) << name << " write failed: " << std::strerror(errno) << std::endl;
+        }
+        metrics.write_seconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+        metrics.written_bytes.add(bytes);
+
+        if(!sink.written){
+            sink.written = true;
+            boost::posix_time::time_duration delay = boost::posix_time::microsec_clock::local_time() - sink.valid_from;
+            metrics.start_delay_seconds.observe(std::max<long>(delay.total_microseconds(), 0) / 1e6);
+        }
+    }
+
+    void skew(const Sink& sink, const boost::posix_time::ptime& received){
+        //called by the Writer thread when the first byte of a recording arrived: how long after its
+        //scheduled start, for every recording
+        double seconds = std::max<long>((received - sink.valid_from).total_microseconds(), 0) / 1e6;
+        metrics.start_skew_seconds.observe(seconds);
+        std::ostringstream late;
+        late << std::fixed << std::setprecision(3) << seconds;
+        std::cout << "[OK ] " << std::left << std::setw(8) << name << " recording of " << sink.valid_from << " began " << late.str() << " s after its start" << std::endl;
+    }
+
+    void measure(const Chunk& chunk){
+        //called by the Writer thread for every chunk recorded. Gaps in the stream spoil the window
+        static const std::chrono::seconds window(60);
+        if(chunk.discontinuity || rate_bytes == 0){
+            rate_since = chunk.received;
+            rate_bytes = chunk.size;
+            return;
+        }
+        rate_bytes += chunk.size;
+        if(chunk.received - rate_since >= window){
+            byte_rate = rate_bytes / std::chrono::duration<double>(chunk.received - rate_since).count();
+            metrics.byte_rate.set(static_cast<uint64_t>(byte_rate));
+            rate_since = chunk.received;
+            rate_bytes = 0;
+        }
+    }
+
+    off_t estimate(const Sink& sink) const {
+        //size of a recording: by the last minute measured, a part of it will do as well, or a generous guess
+        double rate = byte_rate;
+        if(rate == 0){
+            auto partial = std::chrono::duration<double>(std::chrono::system_clock::now() - rate_since).count();
+            rate = rate_bytes > 0 && partial >= 5 ? rate_bytes / partial : PreRoll::bytes_per_second;
+        }
+        //with a margin for a bitrate which varies a little
+        double seconds = (sink.valid_until - sink.valid_from).total_seconds() + 1;
+        return static_cast<off_t>(rate * seconds * 1.05);
+    }
+
+    void close_sinks(){
+        //called by the Writer thread when the station is removed, ends its recordings with what has been received
+        drain();
+        for(auto& sink: sinks){
+            sink.finished = true;
+            flush(sink);
+        }
+        sinks.clear();
+        copy(~uint64_t(0));
+        metrics.sinks.set(0);
+        std::lock_guard<std::mutex> lock(*sinks_mutex);
+        attached.clear();
+    }
+
+    Framer::Codec codec() const {
+        return framer->codec();
+    }
+
+    uint64_t receive_pauses() const {
+        return ring->pauses;
+    }
+
+    uint64_t discarded_bytes() const {
+        return ring->overflow_bytes;
     }
 
     void attach(Sink&& sink){
         //called by the scheduling thread to notify the Station of a new Sink
         std::lock_guard<std::mutex> lock(*sinks_mutex);
-        sinks.emplace_back(std::move(sink));
+        attached.emplace_back(std::move(sink));
     }
-    Station(size_t id, const std::string& name, const std::string& original_url, Strategy strategy, long timeout_direct, long timeout_playlist):
+    Station(size_t id, const std::string& name, const std::string& original_url, Strategy strategy, size_t connections, long timeout_direct, long timeout_playlist, long playlist_cache, size_t ring_chunks, long preroll_seconds, size_t write_buffer):
         id(id),
         name(name),
         original_url(original_url),
         strategy(strategy),
         timeout_direct(timeout_direct),
         timeout_playlist(timeout_playlist),
+        playlist_cache(playlist_cache),
+        write_buffer(write_buffer),
+        metrics(),
         sinks_mutex(std::make_unique<std::mutex>()),
+        attached(),
         sinks(),
-        last_progress_time(boost::posix_time::not_a_date_time),
-        last_progress_bytes(0),
-        thread()
-    {}
+        copies(),
+        framer(std::make_unique<Framer>()),
+        preroll(preroll_seconds > 0 ? std::make_unique<PreRoll>(preroll_seconds) : nullptr),
+        merger(),
+        writer_event_fd(-1),
+        rate_since(),
+        rate_bytes(0),
+        byte_rate(0),
+        title(),
+        position(0),
+        sink_serial(0),
+        ring(std::make_unique<ChunkRing>(ring_chunks)),
+        downloader(nullptr),
+        connected(false),
+        links(connections, Link{nullptr, boost::posix_time::not_a_date_time, false, false, false, false, 0}),
+        attempts(),
+        playlist_transfer(nullptr),
+        playlist(),
+        urls(),
+        resolved(boost::posix_time::not_a_date_time)
+    {
+        if(connections > 1){
+            //a stalled link is replaced long before its transfer times out
+            merger = std::make_unique<Merger>(*ring, connections, std::chrono::milliseconds(timeout_direct * 1000 / 4));
+        }
+    }
+
+    size_t connections() const {
+        return links.size();
+    }
 private:
     static size_t write_callback_direct(char *ptr, size_t size, size_t nmemb, void *userdata){
-        Station* station = static_cast<Station*>(userdata);
+        Attempt* attempt = static_cast<Attempt*>(userdata);
+        Station* station = attempt->station;
+        Link& link = station->links[attempt->link];
+        auto received = std::chrono::system_clock::now();
+        bool was_empty = false;
+
+        if(link.transfer != attempt->easyhandle){
+            if(link.transfer != nullptr){
+                //lost the race, aborts the transfer
+                return 0;
+            }
+            //the first attempt to deliver takes over, the others are aborted
+            if(link.racing){
+                std::cout << "[OK ] " << std::left << std::setw(8) << station->name << " " << station->urls[attempt->url_index] << " won the race" << std::endl;
+            }
+            link.transfer = attempt->easyhandle;
+            link.url_index = attempt->url_index;
+            link.racing = false;
+        }
 
-        std::lock_guard<std::mutex> lock(*station->sinks_mutex);
+        //the audio is never more than what has been received, so once there is room for that the push succeeds
+        if(!station->ring->room(size * nmemb)){
+            if(link.overflowing){
+                //the Writer fell behind for longer than the stream could wait, keep the connection and discard
+                attempt->icy.split(ptr, size * nmemb);
+                station->ring->overflow_bytes += size * nmemb;
+                return size * nmemb;
+            }
 
-        //erase expired sinks
-        boost::posix_time::ptime now(boost::posix_time::microsec_clock::local_time());
-        station->sinks.erase(std::remove_if(station->sinks.begin(), station->sinks.end(), [&now](const Sink& sink){return sink.valid_until < now;}), station->sinks.end());
+            //ask the Writer to resume us once it made room; it might have done so in between
+            station->ring->paused.store(true);
+            if(!station->ring->room(size * nmemb)){
+                ++station->ring->pauses;
+                link.paused_since = boost::posix_time::microsec_clock::local_time();
+                return CURL_WRITEFUNC_PAUSE;
+            }
+        }
 
-        //write received data to all of the sinks
-        for(auto& sink: station->sinks){
-            sink.destination->write(ptr, size * nmemb);
+        IcyDemuxer& icy = attempt->icy;
+        const std::vector<iovec>& runs = icy.split(ptr, size * nmemb);
+        size_t audio = 0;
+        for(auto& run: runs){
+            audio += run.iov_len;
+        }
+        if(audio > 0){
+            station->ring->push(runs.data(), audio, received, link.reconnected, attempt->link, icy.titled ? &icy.title : nullptr, icy.title_offset, was_empty);
+            icy.titled = false;
+            link.reconnected = false;
+        }
+        link.overflowing = false;
+        link.paused_since = boost::posix_time::not_a_date_time;
+        station->metrics.received_bytes.add(size * nmemb);
+
+        if(was_empty){
+            uint64_t one = 1;
+            if(write(station->writer_event_fd, &one, sizeof(one)) != sizeof(one)){
+                std::cout << "[ERR] writer wakeup failed: " << std::strerror(errno) << std::endl;
+            }
         }
 
         return size * nmemb;
     }
 
+    static size_t header_callback_direct(char* buffer, size_t size, size_t nitems, void* userdata){
+        //finds out whether and how often the server interleaves metadata, for every response. Responses
+        //other than 2xx are aborted before their body could win the race and end up in the recordings
+        Attempt* attempt = static_cast<Attempt*>(userdata);
+        size_t length = size * nitems;
+        bool http = length >= 5 && std::strncmp(buffer, "HTTP/", 5) == 0;
+        if(http || (length >= 4 && std::strncmp(buffer, "ICY ", 4) == 0)){
+            attempt->icy.reset(0);
+            //"HTTP/1.1 200 OK" or "ICY 200 OK"
+            std::string line(buffer, length);
+            size_t code = http ? line.find(' ') : 3;
+            long status = code == std::string::npos ? 0 : std::strtol(line.c_str() + code, nullptr, 10);
+            //informational 1xx are followed by the final status line
+            if(status < 100 || status > 299){
+                char* url = nullptr;
+                curl_easy_getinfo(attempt->easyhandle, CURLINFO_EFFECTIVE_URL, &url);
+                line.erase(line.find_last_not_of("\r\n") + 1);
+                std::cout << "[ERR] " << std::left << std::setw(8) << attempt->station->name << " " << (url ? url : "") << " answered '" << line << "'" << std::endl;
+                return 0;
+            }
+        }
+        else if(length > 12 && strncasecmp(buffer, "icy-metaint:", 12) == 0){
+            attempt->icy.reset(std::strtoul(std::string(buffer + 12, length - 12).c_str(), nullptr, 10));
+        }
+        return length;
+    }
+
+    static curl_slist* icy_request(){
+        //shared by all transfers for as long as the program runs
+        static curl_slist* headers = curl_slist_append(nullptr, "Icy-MetaData: 1");
+        return headers;
+    }
+
     static size_t write_callback_playlist(char* ptr, size_t size, size_t nmemb, void *userdata){
         std::string* m3u = static_cast<std::string*>(userdata);
 
@@ -128,57 +1338,117 @@ private:
         (void) ultotal;
         (void) ulnow;
 
-        Station* station = static_cast<Station*>(userdata);
+        Attempt* attempt = static_cast<Attempt*>(userdata);
+        Station* station = attempt->station;
+        const Link& link = station->links[attempt->link];
         boost::posix_time::ptime now(boost::posix_time::microsec_clock::local_time());
 
-        if(dlnow != station->last_progress_bytes){
-            if(station->last_progress_bytes == 0){
+        if(link.transfer != nullptr && link.transfer != attempt->easyhandle){
+            //lost the race
+            return -1;
+        }
+
+        if(!link.paused_since.is_not_a_date_time()){
+            //waiting for the Writer is no network timeout
+            attempt->last_progress_time = now;
+            return 0;
+        }
+
+        if(dlnow != attempt->last_progress_bytes){
+            if(attempt->last_progress_bytes == 0){
                 std::cout << "[OK ] " << std::left << std::setw(8) << station->name << " direct first packet received" << std::endl;
             }
-            //std::cout << "dT: " << (now - station->last_progress_time) << std::endl;
+            //std::cout << "dT: " << (now - attempt->last_progress_time) << std::endl;
+            if(attempt->last_progress_bytes != 0 && now - attempt->last_progress_time > boost::posix_time::seconds(1)){
+                station->metrics.stall_seconds.observe((now - attempt->last_progress_time).total_milliseconds() / 1e3);
+            }
 
-            station->last_progress_time = now;
-            station->last_progress_bytes = dlnow;
+            attempt->last_progress_time = now;
+            attempt->last_progress_bytes = dlnow;
             return 0;
         }
-        if(now - station->last_progress_time > boost::posix_time::seconds(station->timeout_direct)){
+        if(now - attempt->last_progress_time > boost::posix_time::seconds(station->timeout_direct)){
             std::cout << "[ERR] " << std::left << std::setw(8) << station->name << " direct info timeout" << std::endl;
-
-            station->last_progress_time = boost::posix_time::not_a_date_time;
-            station->last_progress_bytes = 0;
+            station->metrics.stall_seconds.observe((now - attempt->last_progress_time).total_milliseconds() / 1e3);
             return -1;
         }
 
         return 0;
     }
 
-    void download_direct(const std::string& url){
+    void resume(Link& link){
+        if(link.transfer != nullptr && !link.paused_since.is_not_a_date_time()){
+            link.paused_since = boost::posix_time::not_a_date_time;
+            for(auto& attempt: attempts){
+                if(attempt->easyhandle == link.transfer){
+                    attempt->last_progress_time = boost::posix_time::microsec_clock::local_time();
+                }
+            }
+            curl_easy_pause(link.transfer, CURLPAUSE_CONT);
+        }
+    }
+
+    void reconnect(CURLM* multi, size_t index, bool worked){
+        //a playlist's entry which `worked` until now is tried again while the playlist is fresh, then
+        //several of its entries at once, and only then the playlist is fetched again
+        Link& link = links[index];
+        if(strategy == Strategy::direct){
+            download_direct(multi, index, original_url, 0);
+            return;
+        }
+        bool fresh = !urls.empty() && boost::posix_time::microsec_clock::local_time() - resolved < boost::posix_time::seconds(playlist_cache);
+        if(fresh && worked){
+            link.racing = false;
+            download_direct(multi, index, urls[link.url_index], link.url_index);
+        }
+        else if(fresh && !link.racing){
+            race(multi, index);
+        }
+        else {
+            //shared by all links
+            link.waiting = true;
+            if(playlist_transfer == nullptr){
+                download_playlist(multi, original_url);
+            }
+        }
+    }
+
+    void race(CURLM* multi, size_t index){
+        //beginning with the entry which worked last
+        Link& link = links[index];
+        link.racing = true;
+        for(size_t i = 0; i < std::min(urls.size(), race_width); ++i){
+            size_t url_index = (link.url_index + i) % urls.size();
+            download_direct(multi, index, urls[url_index], url_index);
+        }
+    }
+
+    void download_direct(CURLM* multi, size_t index, const std::string& url, size_t url_index){
         CURL* easyhandle = curl_easy_init();
+        attempts.emplace_back(new Attempt{this, index, easyhandle, url_index, boost::posix_time::microsec_clock::local_time(), 0, IcyDemuxer()});
         curl_easy_setopt(easyhandle, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(easyhandle, CURLOPT_PRIVATE, this);
 
         curl_easy_setopt(easyhandle, CURLOPT_WRITEFUNCTION, write_callback_direct);
-        curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, this);
+        curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, attempts.back().get());
+
+        //ask for the titles, which are separated from the audio as it is received
+        curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, icy_request());
+        curl_easy_setopt(easyhandle, CURLOPT_HEADERFUNCTION, header_callback_direct);
+        curl_easy_setopt(easyhandle, CURLOPT_HEADERDATA, attempts.back().get());
 
         curl_easy_setopt(easyhandle, CURLOPT_XFERINFOFUNCTION, progress_callback_direct);
-        curl_easy_setopt(easyhandle, CURLOPT_XFERINFODATA, this);
+        curl_easy_setopt(easyhandle, CURLOPT_XFERINFODATA, attempts.back().get());
 
         curl_easy_setopt(easyhandle, CURLOPT_NOPROGRESS, 0L);
-        last_progress_time = boost::posix_time::microsec_clock::local_time();
+        Link& link = links[index];
+        link.paused_since = boost::posix_time::not_a_date_time;
+        link.overflowing = false;
+        link.reconnected = true;
 
         std::cout << "[OK ] " << std::left << std::setw(8) << name << " performing direct request to " << url << std::endl;
 
-
-        CURLcode success = curl_easy_perform(easyhandle);
-
-        std::cout << "[ERR] " << std::left << std::setw(8) << name << " " << curl_easy_strerror(success) << std::endl;
-
-        curl_easy_cleanup(easyhandle);
-    }
-
-    void download_direct_loop(const std::string& url){
-        while(true){
-            download_direct(url);
-        }
+        curl_multi_add_handle(multi, easyhandle);
     }
 
     std::vector<std::string> parse_m3u(const std::string& input){
@@ -253,11 +1523,12 @@ private:
         return result;
     }
 
-    void download_playlist(const std::string& url){
+    void download_playlist(CURLM* multi, const std::string& url){
         CURL* easyhandle = curl_easy_init();
-        std::string playlist;
+        playlist.clear();
 
         curl_easy_setopt(easyhandle, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(easyhandle, CURLOPT_PRIVATE, this);
 
         curl_easy_setopt(easyhandle, CURLOPT_WRITEFUNCTION, write_callback_playlist);
         curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, &playlist);
@@ -265,18 +1536,21 @@ private:
         curl_easy_setopt(easyhandle, CURLOPT_TIMEOUT, timeout_playlist);
 
         //std::cout << name << " playlist download starts" << std::endl;
-        CURLcode success = curl_easy_perform(easyhandle);
-        curl_easy_cleanup(easyhandle);
+        playlist_transfer = easyhandle;
+        curl_multi_add_handle(multi, easyhandle);
+    }
 
+    void playlist_fetched(CURLM* multi, CURLcode success){
         if (success != CURLE_OK && success != CURLE_WRITE_ERROR){
             std::cout << "[ERR] " << std::left << std::setw(8) << name << " " << curl_easy_strerror(success) << std::endl;
+            download_playlist(multi, original_url);
             return;
         }
 
         std::cout << "[OK ] " << std::left << std::setw(8) << name << " playlist fetched" << std::endl;
 
         std::replace(playlist.begin(), playlist.end(), '\r', '\n');
-        std::vector<std::string> urls;
+        urls.clear();
 
         if(strategy == Strategy::m3u){
             urls = parse_m3u(playlist);
@@ -287,34 +1561,376 @@ private:
 
         if (urls.empty()){
             std::cout << "[ERR] " << std::left << std::setw(8) << name << "no url found in playlist file" << std::endl;
+            download_playlist(multi, original_url);
         }
         else{
-            for(auto& url: urls){
-                download_direct(url);
+            //the links begin with different entries if there are enough of them
+            resolved = boost::posix_time::microsec_clock::local_time();
+            for(size_t index = 0; index < links.size(); ++index){
+                if(links[index].waiting){
+                    links[index].waiting = false;
+                    links[index].url_index = index % urls.size();
+                    race(multi, index);
+                }
+            }
+        }
+    }
+};
+
+const size_t Station::race_width;
+
+class Downloader {
+    //drives the transfers of many stations from a single thread: a curl multi
+    //handle whose sockets and timeout are watched by epoll
+    CURLM* multi;
+    int epoll_fd;
+    int timer_fd;
+    int event_fd;
+
+    //requests of other threads, carried out by the downloader thread in order
+    enum class Request { add, remove, connect, disconnect, resume };
+    struct Pending {
+        Station* station;
+        Request request;
+        std::function<void()> done; //called by the downloader thread afterwards
+    };
+    std::mutex pending_mutex;
+    std::vector<Pending> pending;
+    //all stations driven by this downloader, only accessed by the downloader thread
+    std::vector<Station*> stations;
+
+    std::thread thread;
+
+public:
+    Downloader():
+        multi(curl_multi_init()),
+        epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+        timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+        event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+        pending_mutex(),
+        pending(),
+        stations(),
+        thread()
+    {
+        assert(multi != nullptr);
+        assert(epoll_fd >= 0 && timer_fd >= 0 && event_fd >= 0);
+
+        curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+        curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+        curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+        event.data.fd = event_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &event);
+    }
+    Downloader(const Downloader&) = delete;
+    Downloader& operator=(const Downloader&) = delete;
+
+    void spawn(){
+        this->thread = std::thread(&Downloader::run, this);
+    }
+
+    void add(Station& station){
+        //called by the scheduling thread
+        station.downloader = this;
+        request(station, Request::add);
+    }
+
+    void remove(Station& station, std::function<void()> removed){
+        //called by any thread, disconnects the station and forgets it. `removed` is called once
+        //the station is no longer accessed by this downloader
+        request(station, Request::remove, std::move(removed));
+    }
+
+    void connect(Station& station){
+        //called by the scheduling thread
+        request(station, Request::connect);
+    }
+
+    void disconnect(Station& station){
+        //called by the scheduling thread
+        request(station, Request::disconnect);
+    }
+
+    void resume(Station& station){
+        //called by a Writer thread once it made room for a paused transfer
+        request(station, Request::resume);
+    }
+
+private:
+    void request(Station& station, Request request, std::function<void()> done = nullptr){
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            pending.push_back(Pending{&station, request, std::move(done)});
+        }
+        uint64_t one = 1;
+        if(write(event_fd, &one, sizeof(one)) != sizeof(one)){
+            std::cout << "[ERR] downloader wakeup failed: " << std::strerror(errno) << std::endl;
+        }
+    }
+
+    static int socket_callback(CURL* easyhandle, curl_socket_t socket, int what, void* userdata, void* socketdata){
+        (void) easyhandle;
+        Downloader* downloader = static_cast<Downloader*>(userdata);
+
+        if(what == CURL_POLL_REMOVE){
+            epoll_ctl(downloader->epoll_fd, EPOLL_CTL_DEL, socket, nullptr);
+            return 0;
+        }
+
+        epoll_event event{};
+        event.events = (what & CURL_POLL_IN ? uint32_t(EPOLLIN) : 0) | (what & CURL_POLL_OUT ? uint32_t(EPOLLOUT) : 0);
+        event.data.fd = socket;
+        if(socketdata == nullptr){
+            //first time we hear of this socket: mark it as known
+            epoll_ctl(downloader->epoll_fd, EPOLL_CTL_ADD, socket, &event);
+            curl_multi_assign(downloader->multi, socket, downloader);
+        }
+        else {
+            epoll_ctl(downloader->epoll_fd, EPOLL_CTL_MOD, socket, &event);
+        }
+        return 0;
+    }
+
+    static int timer_callback(CURLM* multi, long timeout_ms, void* userdata){
+        (void) multi;
+        Downloader* downloader = static_cast<Downloader*>(userdata);
+
+        //-1 deletes the timer, 0 asks to be called as soon as possible
+        itimerspec its{};
+        if(timeout_ms > 0){
+            its.it_value.tv_sec = timeout_ms / 1000;
+            its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+        }
+        else if(timeout_ms == 0){
+            its.it_value.tv_nsec = 1;
+        }
+        timerfd_settime(downloader->timer_fd, 0, &its, nullptr);
+        return 0;
+    }
+
+    void run(){
+        const int max_events = 64;
+        epoll_event events[max_events];
+        int running;
+        boost::posix_time::ptime last_check(boost::posix_time::microsec_clock::local_time());
+
+        while(true){
+            //transfers paused for the Writers are checked once a second
+            int count = epoll_wait(epoll_fd, events, max_events, 1000);
+            boost::posix_time::ptime now(boost::posix_time::microsec_clock::local_time());
+            if(now - last_check >= boost::posix_time::seconds(1)){
+                last_check = now;
+                for(auto station: stations){
+                    station->check_paused(now);
+                }
+            }
+
+            if(count < 0){
+                if(errno != EINTR){
+                    std::cout << "[ERR] downloader epoll_wait: " << std::strerror(errno) << std::endl;
+                }
+                continue;
+            }
+
+            for(int i = 0; i < count; ++i){
+                int fd = events[i].data.fd;
+                if(fd == timer_fd){
+                    uint64_t expirations;
+                    if(read(timer_fd, &expirations, sizeof(expirations)) > 0){
+                        curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+                    }
+                }
+                else if(fd == event_fd){
+                    uint64_t value;
+                    if(read(event_fd, &value, sizeof(value)) > 0){
+                        std::vector<Pending> requests;
+                        {
+                            std::lock_guard<std::mutex> lock(pending_mutex);
+                            requests.swap(pending);
+                        }
+                        for(auto& request: requests){
+                            switch(request.request){
+                                case Request::add: stations.push_back(request.station); break;
+                                case Request::remove:
+                                    request.station->disconnect(multi);
+                                    stations.erase(std::remove(stations.begin(), stations.end(), request.station), stations.end());
+                                    break;
+                                case Request::connect: request.station->connect(multi); break;
+                                case Request::disconnect: request.station->disconnect(multi); break;
+                                case Request::resume: request.station->resume(); break;
+                            }
+                            if(request.done){
+                                request.done();
+                            }
+                        }
+                    }
+                }
+                else {
+                    int flags = (events[i].events & EPOLLIN ? CURL_CSELECT_IN : 0)
+                        | (events[i].events & EPOLLOUT ? CURL_CSELECT_OUT : 0)
+                        | (events[i].events & (EPOLLERR | EPOLLHUP) ? CURL_CSELECT_ERR : 0);
+                    curl_multi_socket_action(multi, fd, flags, &running);
+                }
+            }
+
+            //hand finished transfers back to their stations, which reconnect
+            CURLMsg* message;
+            int queued;
+            while((message = curl_multi_info_read(multi, &queued))){
+                if(message->msg != CURLMSG_DONE){
+                    continue;
+                }
+                CURL* easyhandle = message->easy_handle;
+                CURLcode success = message->data.result;
+                char* station;
+                curl_easy_getinfo(easyhandle, CURLINFO_PRIVATE, &station);
+                reinterpret_cast<Station*>(station)->done(multi, easyhandle, success);
             }
         }
     }
+};
+
+class Writer {
+    //drains the rings of its stations into their sinks, so that slow disks
+    //never hold up the Downloader threads receiving the streams
+    int event_fd;
+
+    //stations added and removed by the scheduling thread, taken over by the writer thread in order
+    struct Pending {
+        Station* station;
+        bool add;
+        std::function<void()> removed;
+    };
+    std::mutex pending_mutex;
+    std::vector<Pending> pending;
+    //only accessed by the writer thread
+    std::vector<Station*> stations;
+
+    std::thread thread;
+
+public:
+    Writer():
+        event_fd(eventfd(0, EFD_CLOEXEC)),
+        pending_mutex(),
+        pending(),
+        stations(),
+        thread()
+    {
+        assert(event_fd >= 0);
+    }
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void add(Station& station){
+        //called by the scheduling thread
+        station.writer_event_fd = event_fd;
+        request(Pending{&station, true, nullptr});
+    }
+
+    void remove(Station& station, std::function<void()> removed){
+        //called by the scheduling thread, ends the recordings of the station and forgets it.
+        //`removed` is called by the writer thread once it no longer accesses the station
+        request(Pending{&station, false, std::move(removed)});
+    }
+
+    void spawn(){
+        this->thread = std::thread(&Writer::run, this);
+    }
+
+private:
+    void request(Pending&& change){
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            pending.push_back(std::move(change));
+        }
+        uint64_t one = 1;
+        if(write(event_fd, &one, sizeof(one)) != sizeof(one)){
+            std::cout << "[ERR] writer wakeup failed: " << std::strerror(errno) << std::endl;
+        }
+    }
 
-    void download_playlist_loop(const std::string& url){
+    void run(){
         while(true){
-            download_playlist(url);
+            std::vector<Pending> changes;
+            {
+                std::lock_guard<std::mutex> lock(pending_mutex);
+                changes.swap(pending);
+            }
+            for(auto& change: changes){
+                if(change.add){
+                    stations.push_back(change.station);
+                    continue;
+                }
+                change.station->close_sinks();
+                stations.erase(std::remove(stations.begin(), stations.end(), change.station), stations.end());
+                change.removed();
+            }
+
+            bool idle = true;
+            for(auto station: stations){
+                if(station->drain()){
+                    station->downloader->resume(*station);
+                }
+                idle = idle && station->drained();
+            }
+            if(!idle){
+                continue;
+            }
+
+            //stations only wake us up when we had caught up with them, batches
+            //of data which is not followed by more are flushed after a while
+            pollfd wakeup{event_fd, POLLIN, 0};
+            int ready = poll(&wakeup, 1, Sink::batch_delay_ms);
+            uint64_t value;
+            if(ready < 0 && errno != EINTR){
+                std::cout << "[ERR] writer poll: " << std::strerror(errno) << std::endl;
+            }
+            else if(ready > 0 && read(event_fd, &value, sizeof(value)) < 0){
+                std::cout << "[ERR] writer read: " << std::strerror(errno) << std::endl;
+            }
         }
     }
 };
 
 class Event {
 public:
+    //with on demand connections a programme's station is connected ahead of its start
+    //and disconnected after its end, unless it is needed by another programme
+    enum class Type { connect, start, disconnect };
+
+    //starts are handled ahead of time, so that opening the files and waking up late do not delay
+    //the recording: it is in place before the programme begins and takes the first frame received
+    //from then on. Connects keep their warm-up relative to that
+    static boost::posix_time::time_duration lead(){
+        return boost::posix_time::seconds(2);
+    }
+
+    size_t station;
     size_t programme;
     boost::posix_time::ptime time;
     boost::posix_time::time_duration duration;
+    Type type;
+    boost::posix_time::ptime at; //when it is handled
 
-    Event(size_t programme, const boost::posix_time::ptime& time, const boost::posix_time::time_duration& duration):
+    Event(size_t station, size_t programme, const boost::posix_time::ptime& time, const boost::posix_time::time_duration& duration, Type type = Type::start):
+        station(station),
         programme(programme),
         time(time),
-        duration(duration)
+        duration(duration),
+        type(type),
+        at(type == Type::disconnect ? time : time - lead())
     {}
 
     friend bool operator<(const Event& ev1, const Event& ev2){
+        if(ev1.at != ev2.at)
+            return ev1.at > ev2.at;
+        if(ev1.time == ev2.time && ev1.type != ev2.type)
+            return ev1.type > ev2.type;
         if(ev1.time == ev2.time)
             return ev1.duration > ev2.duration;
         return ev1.time > ev2.time; //reverse order in priority_queue
@@ -323,22 +1939,404 @@ public:
 };
 
 class Scheduler {
+    //the settings of a configuration file, compared with the running stations and programmes on reload
+    struct Configuration {
+        struct ProgrammeSetting {
+            std::string name;
+            std::string schedule;
+            int duration;
+        };
+        struct StationSetting {
+            std::string name;
+            Station::Strategy strategy;
+            std::string url;
+            std::vector<ProgrammeSetting> programmes;
+            int connections;
+        };
+
+        std::string destinationPath;
+        long timeout_direct;
+        long timeout_playlist;
+        long playlist_cache;
+        bool calendar;
+        int download_threads;
+        int write_threads;
+        bool on_demand;
+        long warm_up;
+        int preroll;
+        int receive_buffer;
+        int write_buffer;
+        std::string metrics_path;
+        long metrics_interval;
+        long hls_segment;
+        std::string schedule_cache;
+        std::vector<StationSetting> stations;
+    };
+
+    std::string config_path;
+    bool dry_run; //for a forecast, the stations are never received
     std::string destinationPath;
-    std::vector<Station> stations;
-    std::vector<Programme> programmes;
-
-    std::priority_queue<Event> schedule;
-
+    //indexed by their ids, which are never reused. Removed ones leave a nullptr behind
+    std::vector<std::unique_ptr<Station>> stations;
+    std::vector<std::unique_ptr<Programme>> programmes;
+    //removed stations, until the Writer and Downloader threads have let go of them
+    std::vector<std::unique_ptr<Station>> retired;
+    int download_threads;
+    int write_threads;
+    std::vector<std::unique_ptr<Downloader>> downloaders;
+    std::vector<std::unique_ptr<Writer>> writers;
+
+    //settings of the stations and programmes added next
+    long timeout_direct;
+    long timeout_playlist;
+    long playlist_cache;
+    size_t ring_chunks;
+    int preroll;
+    size_t write_buffer;
+
+    //upcoming events in a timer wheel, those which are due in `due`
+    TimerWheel<Event> schedule;
+    std::priority_queue<Event> due;
+    std::vector<TimerWheel<Event>::Handle> start_events; //of every programme
+    std::vector<TimerWheel<Event>::Handle> connect_events; //of every programme
+
+    //the scheduling thread waits for the next event with timer_fd and is woken by
+    //other threads with event_fd when they post work, and by SIGHUP through signal_fd
+    int timer_fd;
+    int event_fd;
+    int signal_fd;
+    std::mutex posted_mutex;
+    std::vector<std::function<void()>> posted;
+
+    //metrics of all stations, rewritten every metrics_interval if a path is set
+    std::string metrics_path;
+    boost::posix_time::time_duration metrics_interval;
+    boost::posix_time::ptime next_metrics;
+
+    //recordings started from now on are also cut into HLS segments of this length, unless it is 0
+    boost::posix_time::time_duration hls_segment;
+
+    //the compiled schedules of the current programmes by their text, kept in a file if a path is set
+    std::string schedule_cache;
+    std::unordered_map<std::string, std::shared_ptr<NextFunctor::Compiled>> compiled_schedules;
+
+    //on demand connections
+    bool on_demand;
+    boost::posix_time::time_duration warm_up;
+    std::vector<std::vector<size_t>> station_programmes;
+    std::vector<boost::posix_time::ptime> next_start; //of every programme
+    std::vector<bool> connected; //of every station
+    std::vector<boost::posix_time::ptime> busy_until; //of every station
 
 public:
     Scheduler():
+        config_path(),
+        dry_run(false),
         destinationPath(),
         stations(),
         programmes(),
-        schedule()
-    {}
+        retired(),
+        download_threads(1),
+        write_threads(1),
+        downloaders(),
+        writers(),
+        timeout_direct(0),
+        timeout_playlist(0),
+        playlist_cache(0),
+        ring_chunks(0),
+        preroll(0),
+        write_buffer(0),
+        schedule(tick(boost::posix_time::second_clock::local_time())),
+        due(),
+        start_events(),
+        connect_events(),
+        timer_fd(timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC)),
+        event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+        signal_fd(hangup_fd()),
+        posted_mutex(),
+        posted(),
+        metrics_path(),
+        metrics_interval(boost::posix_time::seconds(15)),
+        next_metrics(boost::posix_time::neg_infin),
+        hls_segment(boost::posix_time::seconds(0)),
+        schedule_cache(),
+        compiled_schedules(),
+        on_demand(false),
+        warm_up(boost::posix_time::seconds(60)),
+        station_programmes(),
+        next_start(),
+        connected(),
+        busy_until()
+    {
+        assert(timer_fd >= 0 && event_fd >= 0 && signal_fd >= 0);
+    }
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    ~Scheduler(){
+        close(timer_fd);
+        close(event_fd);
+        close(signal_fd);
+    }
+
+    int readConfig(const std::string& config_path, bool dry_run = false){
+        Configuration configuration;
+        if(parse(config_path, configuration) != EXIT_SUCCESS){
+            return(EXIT_FAILURE);
+        }
+        this->config_path = config_path;
+        this->dry_run = dry_run;
+        download_threads = configuration.download_threads;
+        write_threads = configuration.write_threads;
+        on_demand = configuration.on_demand;
+        return apply(configuration);
+    }
+
+    int forecast(const boost::posix_time::ptime& from, const boost::posix_time::ptime& to, const std::string& rates_path){
+        //dry run of the configuration read before: enumerates the recordings starting in [from, to) and reports
+        //how many of them overlap per station, and what they take in disk space and write bandwidth. Stations
+        //are assumed to send at the rates given, or else at the guess used for preallocation
+        auto begun = std::chrono::steady_clock::now();
+        std::unordered_map<std::string, double> rates;
+        if(!rates_path.empty() && !read_rates(rates_path, rates)){
+            return EXIT_FAILURE;
+        }
+
+        struct Tally {
+            double rate;
+            bool known;
+            size_t recordings;
+            double bytes;
+            int peak;
+            int64_t peak_at;
+            std::vector<std::pair<int64_t, int>> steps; //changes of the number of recordings, by time
+            std::vector<double> days; //bytes recorded on every day
+        };
+        const int64_t first_day = tick(boost::posix_time::ptime(from.date())) / 86400;
+        const size_t day_count = (to.date() - from.date()).days() + 2;
+        std::vector<Tally> tallies(stations.size());
+
+        //every station on its own: the starts and ends of all of its recordings as sorted runs, merged
+        //into one and swept. Ends are even and starts odd, so back to back recordings do not overlap
+        parallel(stations.size(), [&](size_t station_id){
+            if(!stations[station_id]){
+                return;
+            }
+            Tally& tally = tallies[station_id];
+            auto known = rates.find(stations[station_id]->name);
+            tally.known = known != rates.end();
+            tally.rate = tally.known ? known->second : PreRoll::bytes_per_second;
+            tally.recordings = 0;
+            tally.bytes = 0;
+            tally.days.assign(day_count, 0);
+
+            std::vector<int64_t> edges;
+            for(auto programme_id: station_programmes[station_id]){
+                Programme& programme(*programmes[programme_id]);
+                int64_t duration = programme.duration.total_seconds();
+                size_t runs = edges.size();
+                for(auto& time: programme.next->occurrences(from, to)){
+                    edges.push_back(int64_t(tick(time)) * 2 + 1);
+                }
+                size_t count = edges.size() - runs;
+                for(size_t i = runs; i < runs + count; ++i){
+                    int64_t begin = edges[i] / 2;
+                    edges.push_back((begin + duration) * 2);
+                    //attributed to the days it covers
+                    for(int64_t t = begin; t < begin + duration; ){
+                        int64_t midnight = (t / 86400 + 1) * 86400;
+                        int64_t until = std::min(midnight, begin + duration);
+                        tally.days[std::min<size_t>(t / 86400 - first_day, day_count - 1)] += tally.rate * (until - t);
+                        t = until;
+                    }
+                }
+                std::inplace_merge(edges.begin() + runs, edges.begin() + runs + count, edges.end());
+                std::inplace_merge(edges.begin(), edges.begin() + runs, edges.end());
+                tally.recordings += count;
+                tally.bytes += tally.rate * duration * count;
+            }
+
+            int current = 0;
+            tally.peak = 0;
+            tally.peak_at = 0;
+            for(auto edge: edges){
+                current += edge % 2 ? 1 : -1;
+                if(current > tally.peak){
+                    tally.peak = current;
+                    tally.peak_at = edge / 2;
+                }
+                if(!tally.steps.empty() && tally.steps.back().first == edge / 2){
+                    tally.steps.back().second = current;
+                }
+                else {
+                    tally.steps.emplace_back(edge / 2, current);
+                }
+            }
+        });
+
+        //the write bandwidth of all stations together, from their steps merged pairwise
+        std::vector<std::vector<std::pair<int64_t, double>>> runs;
+        for(auto& station: stations){
+            if(!station){
+                continue;
+            }
+            Tally& tally = tallies[station->id];
+            runs.emplace_back();
+            int previous = 0;
+            for(auto& step: tally.steps){
+                runs.back().emplace_back(step.first, (step.second - previous) * tally.rate);
+                previous = step.second;
+            }
+            std::vector<std::pair<int64_t, int>>().swap(tally.steps);
+        }
+        while(runs.size() > 1){
+            std::vector<std::vector<std::pair<int64_t, double>>> merged((runs.size() + 1) / 2);
+            for(size_t i = 0; i + 1 < runs.size(); i += 2){
+                merged[i / 2].reserve(runs[i].size() + runs[i + 1].size());
+                std::merge(runs[i].begin(), runs[i].end(), runs[i + 1].begin(), runs[i + 1].end(), std::back_inserter(merged[i / 2]));
+            }
+            if(runs.size() % 2){
+                merged.back() = std::move(runs.back());
+            }
+            runs = std::move(merged);
+        }
+        double bandwidth = 0;
+        double peak = 0;
+        int64_t peak_at = 0;
+        if(!runs.empty()){
+            for(size_t i = 0; i < runs[0].size(); ++i){
+                bandwidth += runs[0][i].second;
+                bool last = i + 1 == runs[0].size() || runs[0][i + 1].first != runs[0][i].first;
+                if(last && bandwidth > peak + 1e-6){
+                    peak = bandwidth;
+                    peak_at = runs[0][i].first;
+                }
+            }
+        }
+
+        std::cout << std::left << std::setw(24) << "station" << std::right << std::setw(12) << "kbit/s" << std::setw(12) << "recordings"
+            << std::setw(12) << "concurrent" << std::setw(12) << "disk" << "  peak at" << std::endl;
+        size_t recordings = 0;
+        double total = 0;
+        std::vector<double> days(day_count, 0);
+        for(auto& station: stations){
+            if(!station){
+                continue;
+            }
+            const Tally& tally = tallies[station->id];
+            std::string rate(std::to_string(static_cast<long>(tally.rate * 8 / 1000)));
+            std::cout << std::left << std::setw(24) << station->name << std::right << std::setw(12) << (tally.known ? rate : "(" + rate + ")")
+                << std::setw(12) << tally.recordings << std::setw(12) << tally.peak << std::setw(12) << size(tally.bytes)
+                << "  " << (tally.peak > 0 ? boost::posix_time::to_simple_string(from_tick(tally.peak_at)) : "-") << std::endl;
+            recordings += tally.recordings;
+            total += tally.bytes;
+            for(size_t day = 0; day < day_count; ++day){
+                days[day] += tally.days[day];
+            }
+        }
+        auto busiest = std::max_element(days.begin(), days.end());
+
+        std::cout << "\n" << recordings << " recordings from " << from << " until " << to << ", rates in parentheses are guessed\n"
+            << "disk space:           " << size(total) << ", " << size(total / std::max<long>((to - from).hours() / 24, 1)) << " per day on average\n"
+            << "busiest day:          " << size(*busiest) << " on " << boost::gregorian::to_simple_string(from.date() + boost::gregorian::days(busiest - days.begin())) << "\n"
+            << "peak write bandwidth: " << size(peak) << "/s at " << (peak > 0 ? boost::posix_time::to_simple_string(from_tick(peak_at)) : "-")
+            << " (recordings within another one are copied at their end rather than written along)\n"
+            << "simulated in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begun).count() << " ms" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    void run(){
+        //start the writing and download threads and distribute the stations among them
+        for(int i = 0; i < write_threads; ++i){
+            writers.emplace_back(std::make_unique<Writer>());
+        }
+        for(int i = 0; i < download_threads; ++i){
+            downloaders.emplace_back(std::make_unique<Downloader>());
+        }
+        for(auto& station: stations){
+            start(*station);
+        }
+        for(auto& writer: writers){
+            writer->spawn();
+        }
+        for(auto& downloader: downloaders){
+            downloader->spawn();
+        }
+
+        //their first occurrences were found when the configuration was applied
+        for(auto& programme: programmes){
+            push(programme->programme_id, next_start[programme->programme_id]);
+        }
+
+        //a reload may add programmes, so keep going when there are none
+        while(true){
+            boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
+
+            //coincident events are handled together, in the order of Event
+            std::vector<Event> expired;
+            schedule.advance(tick(now), expired);
+            for(auto& event: expired){
+                due.push(event);
+            }
+            while(!due.empty() && due.top().at <= now){
+                Event event = due.top();
+                due.pop();
+                handle(event);
+            }
+
+            if(!metrics_path.empty() && next_metrics <= now){
+                write_metrics();
+                next_metrics = now + metrics_interval;
+            }
+
+            boost::posix_time::ptime until = from_tick(schedule.next());
+            if(!due.empty()){
+                until = std::min(until, due.top().at);
+            }
+            if(!metrics_path.empty()){
+                until = std::min(until, next_metrics);
+            }
+            bool hangup = wait(until);
+
+            std::vector<std::function<void()>> work;
+            {
+                std::lock_guard<std::mutex> lock(posted_mutex);
+                work.swap(posted);
+            }
+            for(auto& w: work){
+                w();
+            }
+
+            if(hangup){
+                reload();
+            }
+        }
+    }
+
+    void post(std::function<void()> work){
+        //runs `work` on the scheduling thread as soon as possible, may be called from any thread
+        {
+            std::lock_guard<std::mutex> lock(posted_mutex);
+            posted.push_back(std::move(work));
+        }
+        uint64_t one = 1;
+        if(write(event_fd, &one, sizeof(one)) != sizeof(one)){
+            std::cout << "[ERR] scheduler wakeup failed: " << std::strerror(errno) << std::endl;
+        }
+    }
+
+private:
+    static int hangup_fd(){
+        //SIGHUP is blocked before any other thread is started, which inherit the mask, and read from a signalfd
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        return signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
 
-    int readConfig(const std::string& config_path){
+    static int parse(const std::string& config_path, Configuration& configuration){
         using namespace libconfig;
 
         Config cfg;
@@ -361,7 +2359,7 @@ public:
 
         try
         {
-            destinationPath = static_cast<const char*>(cfg.lookup("destinationPath"));
+            configuration.destinationPath = static_cast<const char*>(cfg.lookup("destinationPath"));
         }
         catch(const SettingNotFoundException &nfex)
         {
@@ -369,12 +2367,21 @@ public:
             return(EXIT_FAILURE);
         }
 
-        long timeout_direct;
-        long timeout_playlist;
+        configuration.playlist_cache = 3600;
+        configuration.calendar = false;
+        configuration.download_threads = 1;
+        configuration.write_threads = 1;
+        configuration.on_demand = false;
+        configuration.warm_up = 60;
+        configuration.preroll = 0;
+        configuration.receive_buffer = 4096;
+        configuration.write_buffer = 64;
+        configuration.metrics_interval = 15;
+        configuration.hls_segment = 0;
 
         try
         {
-            timeout_direct = cfg.lookup("timeoutDirect");
+            configuration.timeout_direct = cfg.lookup("timeoutDirect");
         }
         catch(const SettingNotFoundException &nfex)
         {
@@ -383,13 +2390,62 @@ public:
         }
         try
         {
-            timeout_playlist = cfg.lookup("timeoutPlaylist");
+            configuration.timeout_playlist = cfg.lookup("timeoutPlaylist");
         }
         catch(const SettingNotFoundException &nfex)
         {
             std::cerr << "No 'timeoutPlaylist' setting in configuration file." << std::endl;
             return(EXIT_FAILURE);
         }
+        cfg.lookupValue("playlistCache", configuration.playlist_cache);
+        if(configuration.playlist_cache < 0){
+            std::cerr << "'playlistCache' must not be negative." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("calendar", configuration.calendar);
+        cfg.lookupValue("downloadThreads", configuration.download_threads);
+        if(configuration.download_threads < 1){
+            std::cerr << "'downloadThreads' must be at least 1." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("writeThreads", configuration.write_threads);
+        if(configuration.write_threads < 1){
+            std::cerr << "'writeThreads' must be at least 1." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("onDemand", configuration.on_demand);
+        cfg.lookupValue("warmUp", configuration.warm_up);
+        if(configuration.warm_up < 0){
+            std::cerr << "'warmUp' must not be negative." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("preRoll", configuration.preroll);
+        if(configuration.preroll < 0){
+            std::cerr << "'preRoll' must not be negative." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("receiveBuffer", configuration.receive_buffer);
+        if(configuration.receive_buffer < 1){
+            std::cerr << "'receiveBuffer' must be at least 1." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("writeBuffer", configuration.write_buffer);
+        if(configuration.write_buffer < 1){
+            std::cerr << "'writeBuffer' must be at least 1." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("metricsPath", configuration.metrics_path);
+        cfg.lookupValue("metricsInterval", configuration.metrics_interval);
+        if(configuration.metrics_interval < 1){
+            std::cerr << "'metricsInterval' must be at least 1." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("hlsSegment", configuration.hls_segment);
+        if(configuration.hls_segment < 0){
+            std::cerr << "'hlsSegment' must not be negative." << std::endl;
+            return(EXIT_FAILURE);
+        }
+        cfg.lookupValue("scheduleCache", configuration.schedule_cache);
 
 
         try
@@ -400,13 +2456,11 @@ public:
             for(int i = 0; i < station_count; ++i){
                 const Setting& station_setting = schedule_setting[i];
 
-                std::string station_identifier;
-                Station::Strategy station_strategy;
-                std::string station_url;
+                Configuration::StationSetting station;
 
                 try
                 {
-                    station_identifier = static_cast<const char*>(station_setting[0]);
+                    station.name = static_cast<const char*>(station_setting[0]);
                 }
                 catch(const SettingNotFoundException &nfex)
                 {
@@ -419,35 +2473,34 @@ public:
                     std::string strategy_string = static_cast<const char*>(station_setting[1]);
 
                     if(strategy_string == "direct"){
-                        station_strategy = Station::Strategy::direct;
+                        station.strategy = Station::Strategy::direct;
                     }
                     else if(strategy_string == "m3u"){
-                        station_strategy = Station::Strategy::m3u;
+                        station.strategy = Station::Strategy::m3u;
                     }
                     else if(strategy_string == "pls"){
-                        station_strategy = Station::Strategy::pls;
+                        station.strategy = Station::Strategy::pls;
                     }
                     else{
-                        std::cerr << "Station " << station_identifier << "'s strategy is invald. It must either be 'direct', 'm3u' or 'pls'." << std::endl;
+                        std::cerr << "Station " << station.name << "'s strategy is invald. It must either be 'direct', 'm3u' or 'pls'." << std::endl;
                         return(EXIT_FAILURE);
                     }
                 }
                 catch(const SettingNotFoundException &nfex)
                 {
-                    std::cerr << "Station " << station_identifier << " has no strategy" << std::endl;
+                    std::cerr << "Station " << station.name << " has no strategy" << std::endl;
                     return(EXIT_FAILURE);
                 }
 
                 try
                 {
-                    station_url = static_cast<const char*>(station_setting[2]);
+                    station.url = static_cast<const char*>(station_setting[2]);
                 }
                 catch(const SettingNotFoundException &nfex)
                 {
-                    std::cerr << "Station " << station_identifier << " has no URL" << std::endl;
+                    std::cerr << "Station " << station.name << " has no URL" << std::endl;
                     return(EXIT_FAILURE);
                 }
-                stations.emplace_back(stations.size(), station_identifier, station_url, station_strategy, timeout_direct, timeout_playlist);
 
                 try
                 {
@@ -457,48 +2510,57 @@ public:
                     for(int j = 0; j < programme_count; ++j){
                         const Setting& programme_setting = programmes_setting[j];
 
-                        std::string programme_identifier;
-                        std::string programme_schedule;
-                        int programme_duration;
+                        Configuration::ProgrammeSetting programme;
 
                         try
                         {
-                            programme_identifier = static_cast<const char*>(programme_setting[0]);
+                            programme.name = static_cast<const char*>(programme_setting[0]);
                         }
                         catch(const SettingNotFoundException &nfex)
                         {
-                            std::cerr << "Programme without identifier found for station " << station_identifier << std::endl;
+                            std::cerr << "Programme without identifier found for station " << station.name << std::endl;
                             return(EXIT_FAILURE);
                         }
 
                         try
                         {
-                            programme_schedule = static_cast<const char*>(programme_setting[1]);
+                            programme.schedule = static_cast<const char*>(programme_setting[1]);
                         }
                         catch(const SettingNotFoundException &nfex)
                         {
-                            std::cerr << "Programme " << station_identifier << "-" << programme_identifier << " has no schedule string" << std::endl;
+                            std::cerr << "Programme " << station.name << "-" << programme.name << " has no schedule string" << std::endl;
                             return(EXIT_FAILURE);
                         }
 
                         try
                         {
-                            programme_duration = programme_setting[2];
+                            programme.duration = programme_setting[2];
                         }
                         catch(const SettingNotFoundException &nfex)
                         {
-                            std::cerr << "Programme " << station_identifier << "-" << programme_identifier << " has no duration" << std::endl;
+                            std::cerr << "Programme " << station.name << "-" << programme.name << " has no duration" << std::endl;
                             return(EXIT_FAILURE);
                         }
 
-                        programmes.emplace_back(stations.size() - 1, programmes.size(), programme_identifier, NextFunctor::Base::parse(programme_schedule), boost::posix_time::minutes(programme_duration));
+                        station.programmes.push_back(programme);
                     }
                 }
                 catch(const SettingNotFoundException &nfex)
                 {
-                    std::cerr << "Station " << station_identifier << " has no programmes" << std::endl;
+                    std::cerr << "Station " << station.name << " has no programmes" << std::endl;
                     return(EXIT_FAILURE);
                 }
+
+                station.connections = 1;
+                if(station_setting.getLength() > 4){
+                    station.connections = station_setting[4];
+                    if(station.connections < 1){
+                        std::cerr << "Station " << station.name << " needs at least 1 connection" << std::endl;
+                        return(EXIT_FAILURE);
+                    }
+                }
+
+                configuration.stations.push_back(std::move(station));
             }
         }
         catch(const SettingNotFoundException &nfex)
@@ -510,56 +2572,610 @@ public:
         return EXIT_SUCCESS;
     }
 
-    void run(){
-        //start the station curl threads
+    static std::string station_key(const std::string& name, Station::Strategy strategy, const std::string& url, size_t connections){
+        return name + '\n' + std::to_string(static_cast<int>(strategy)) + '\n' + url + '\n' + std::to_string(connections);
+    }
+
+    static std::string programme_key(const std::string& name, const std::string& schedule, long duration){
+        return name + '\n' + schedule + '\n' + std::to_string(duration);
+    }
+
+    static void parallel(size_t count, const std::function<void(size_t)>& work){
+        //calls work(0) to work(count - 1) on all cores, in no particular order
+        size_t threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+        std::atomic<size_t> next(0);
+        auto worker = [&](){
+            for(size_t i = next++; i < count; i = next++){
+                work(i);
+            }
+        };
+        std::vector<std::thread> pool;
+        for(size_t i = 1; i < threads; ++i){
+            pool.emplace_back(worker);
+        }
+        worker();
+        for(auto& thread: pool){
+            thread.join();
+        }
+    }
+
+    int apply(const Configuration& configuration){
+        //compares the configuration with the current stations and programmes and only adds and removes
+        //what differs, everything else keeps running. Only the schedules of new programmes are compiled
+        const size_t none = ~size_t(0);
+
+        //stations and programmes which are configured the same way are kept, in the order they appear
+        std::unordered_map<std::string, std::deque<size_t>> current_stations;
         for(auto& station: stations){
-            station.spawn();
+            if(station){
+                current_stations[station_key(station->name, station->strategy, station->original_url, station->connections())].push_back(station->id);
+            }
+        }
+        std::vector<size_t> matched(configuration.stations.size(), none);
+        std::vector<bool> keep_station(stations.size(), false);
+        std::vector<bool> keep_programme(programmes.size(), false);
+        std::vector<std::pair<size_t, const Configuration::ProgrammeSetting*>> added;
+        for(size_t i = 0; i < configuration.stations.size(); ++i){
+            const auto& setting = configuration.stations[i];
+            auto found = current_stations.find(station_key(setting.name, setting.strategy, setting.url, setting.connections));
+            std::unordered_map<std::string, std::deque<size_t>> current_programmes;
+            if(found != current_stations.end() && !found->second.empty()){
+                matched[i] = found->second.front();
+                found->second.pop_front();
+                keep_station[matched[i]] = true;
+                for(auto programme_id: station_programmes[matched[i]]){
+                    const Programme& programme(*programmes[programme_id]);
+                    current_programmes[programme_key(programme.name, programme.schedule, programme.duration.total_seconds() / 60)].push_back(programme_id);
+                }
+            }
+
+            for(auto& programme: setting.programmes){
+                auto same = current_programmes.find(programme_key(programme.name, programme.schedule, programme.duration));
+                if(same != current_programmes.end() && !same->second.empty()){
+                    keep_programme[same->second.front()] = true;
+                    same->second.pop_front();
+                }
+                else {
+                    added.emplace_back(i, &programme);
+                }
+            }
         }
 
-        {
+        //every distinct new schedule is taken from the current programmes or the cache, or else compiled.
+        //With thousands of programmes this and finding their first occurrences dominate the startup, so
+        //both are spread over all cores
+        std::vector<std::string> texts;
+        std::unordered_map<std::string, size_t> text_index;
+        std::vector<size_t> text_of(added.size());
+        for(size_t i = 0; i < added.size(); ++i){
+            auto inserted = text_index.emplace(added[i].second->schedule, texts.size());
+            if(inserted.second){
+                texts.push_back(added[i].second->schedule);
+            }
+            text_of[i] = inserted.first->second;
+        }
+
+        std::unique_ptr<NextFunctor::Cache> cache;
+        if(!configuration.schedule_cache.empty()){
+            cache = std::make_unique<NextFunctor::Cache>(configuration.schedule_cache);
+        }
+        std::vector<std::shared_ptr<NextFunctor::Compiled>> schedules(texts.size());
+        std::atomic<size_t> misses(0);
+        parallel(texts.size(), [&](size_t i){
+            auto current = compiled_schedules.find(texts[i]);
+            if(current != compiled_schedules.end()){
+                schedules[i] = current->second;
+                return;
+            }
+            if(cache && (schedules[i] = cache->find(texts[i]))){
+                return;
+            }
+            ++misses;
+            schedules[i] = std::static_pointer_cast<NextFunctor::Compiled>(NextFunctor::Base::compile(texts[i]));
+        });
+        for(size_t i = 0; i < added.size(); ++i){
+            if(!schedules[text_of[i]]){
+                const auto& station = configuration.stations[added[i].first];
+                std::cerr << "Programme " << station.name << "-" << added[i].second->name << " has an invalid schedule string" << std::endl;
+                return(EXIT_FAILURE);
+            }
+        }
+
+        std::vector<std::shared_ptr<NextFunctor::Base>> compiled(added.size());
+        std::vector<boost::posix_time::ptime> first(added.size());
+        boost::posix_time::ptime now(boost::posix_time::microsec_clock::local_time());
+        parallel(added.size(), [&](size_t i){
+            std::shared_ptr<NextFunctor::Base> next(schedules[text_of[i]]);
+            if(configuration.calendar){
+                next = std::make_shared<NextFunctor::Calendar>(next);
+            }
+            compiled[i] = next;
+            first[i] = (*next)(now, false);
+        });
+
+        //nothing fails from here on
+        destinationPath = configuration.destinationPath;
+        warm_up = boost::posix_time::seconds(configuration.warm_up);
+        timeout_direct = configuration.timeout_direct;
+        timeout_playlist = configuration.timeout_playlist;
+        playlist_cache = configuration.playlist_cache;
+        //in units of the largest piece of data curl hands over at once. Nothing is received in a dry run
+        ring_chunks = dry_run ? 0 : (configuration.receive_buffer * 1024 + CURL_MAX_WRITE_SIZE - 1) / CURL_MAX_WRITE_SIZE;
+        preroll = dry_run ? 0 : configuration.preroll;
+        write_buffer = configuration.write_buffer * 1024;
+        metrics_path = configuration.metrics_path;
+        metrics_interval = boost::posix_time::seconds(configuration.metrics_interval);
+        hls_segment = boost::posix_time::seconds(configuration.hls_segment);
+        next_metrics = boost::posix_time::neg_infin;
+
+        size_t removed_programmes = 0;
+        size_t removed_stations = 0;
+        for(size_t id = 0; id < keep_programme.size(); ++id){
+            if(programmes[id] && !keep_programme[id]){
+                remove_programme(id);
+                ++removed_programmes;
+            }
+        }
+        for(size_t id = 0; id < keep_station.size(); ++id){
+            if(stations[id] && !keep_station[id]){
+                remove_station(id);
+                ++removed_stations;
+            }
+        }
+
+        size_t added_stations = 0;
+        for(size_t i = 0; i < configuration.stations.size(); ++i){
+            if(matched[i] == none){
+                matched[i] = add_station(configuration.stations[i]);
+                ++added_stations;
+            }
+        }
+        for(size_t i = 0; i < added.size(); ++i){
+            add_programme(matched[added[i].first], *added[i].second, compiled[i], first[i]);
+        }
+
+        std::unordered_map<std::string, std::shared_ptr<NextFunctor::Compiled>> current;
+        for(auto& programme: programmes){
+            if(programme){
+                auto fresh = text_index.find(programme->schedule);
+                current[programme->schedule] = fresh != text_index.end() ? schedules[fresh->second] : compiled_schedules.at(programme->schedule);
+            }
+        }
+        compiled_schedules = std::move(current);
+        if(!configuration.schedule_cache.empty() && (misses > 0 || removed_programmes > 0 || configuration.schedule_cache != schedule_cache)){
+            std::vector<std::pair<std::string, std::shared_ptr<NextFunctor::Compiled>>> entries(compiled_schedules.begin(), compiled_schedules.end());
+            if(!NextFunctor::Cache::write(configuration.schedule_cache, entries)){
+                std::cout << "[ERR] writing the schedule cache " << configuration.schedule_cache << " failed" << std::endl;
+            }
+        }
+        schedule_cache = configuration.schedule_cache;
+
+        if(!downloaders.empty()){
+            std::cout << "[OK ] configuration reloaded, " << added_stations << " stations and " << added.size() << " programmes added, "
+                << removed_stations << " stations and " << removed_programmes << " programmes removed" << std::endl;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    void reload(){
+        //on SIGHUP, changes of the configuration file are applied without a restart
+        Configuration configuration;
+        if(parse(config_path, configuration) != EXIT_SUCCESS){
+            std::cout << "[ERR] reading " << config_path << " failed, the configuration is left unchanged" << std::endl;
+            return;
+        }
+        if(configuration.download_threads != download_threads || configuration.write_threads != write_threads || configuration.on_demand != on_demand){
+            std::cout << "[ERR] 'downloadThreads', 'writeThreads' and 'onDemand' only change with a restart" << std::endl;
+        }
+        if(apply(configuration) != EXIT_SUCCESS){
+            std::cout << "[ERR] applying " << config_path << " failed, the configuration is left unchanged" << std::endl;
+        }
+    }
+
+    size_t add_station(const Configuration::StationSetting& setting){
+        size_t id = stations.size();
+        stations.emplace_back(std::make_unique<Station>(id, setting.name, setting.url, setting.strategy, setting.connections, timeout_direct, timeout_playlist, playlist_cache, ring_chunks, preroll, write_buffer));
+        station_programmes.emplace_back();
+        connected.push_back(false);
+        busy_until.push_back(boost::posix_time::neg_infin);
+        if(!downloaders.empty()){
+            start(*stations.back());
+        }
+        return id;
+    }
+
+    void start(Station& station){
+        //hands the station to its threads
+        downloaders[station.id % downloaders.size()]->add(station);
+        writers[station.id % writers.size()]->add(station);
+        //otherwise all of the stations are received all of the time
+        if(!on_demand){
+            connect(station);
+        }
+    }
+
+    void remove_station(size_t station_id){
+        //its programmes have to be removed before
+        connected[station_id] = false;
+        if(downloaders.empty()){
+            stations[station_id].reset();
+            return;
+        }
+
+        //the Writer ends the recordings first, as it may still ask the Downloader to resume the station
+        Station* station = stations[station_id].get();
+        retired.emplace_back(std::move(stations[station_id]));
+        Downloader* downloader = downloaders[station_id % downloaders.size()].get();
+        writers[station_id % writers.size()]->remove(*station, [this, station, downloader](){
+            downloader->remove(*station, [this, station](){
+                post([this, station](){
+                    retired.erase(std::remove_if(retired.begin(), retired.end(), [station](const std::unique_ptr<Station>& s){return s.get() == station;}), retired.end());
+                });
+            });
+        });
+    }
+
+    void add_programme(size_t station_id, const Configuration::ProgrammeSetting& setting, std::shared_ptr<NextFunctor::Base> next, const boost::posix_time::ptime& first){
+        size_t id = programmes.size();
+        programmes.emplace_back(std::make_unique<Programme>(station_id, id, setting.name, setting.schedule, next, boost::posix_time::minutes(setting.duration)));
+        station_programmes[station_id].push_back(id);
+        next_start.push_back(first);
+        start_events.push_back(TimerWheel<Event>::invalid);
+        connect_events.push_back(TimerWheel<Event>::invalid);
+        //before run() the events are pushed from there
+        if(!downloaders.empty()){
+            push(id, first);
+        }
+    }
+
+    void remove_programme(size_t programme_id){
+        //a recording in progress continues, events already due are skipped by handle()
+        const Programme& programme(*programmes[programme_id]);
+        schedule.cancel(start_events[programme_id]);
+        schedule.cancel(connect_events[programme_id]);
+        auto& siblings = station_programmes[programme.station_id];
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), programme_id), siblings.end());
+        next_start[programme_id] = boost::posix_time::not_a_date_time;
+
+        //the station might have been connected for this programme alone
+        if(on_demand && connected[programme.station_id]){
             boost::posix_time::ptime now(boost::posix_time::microsec_clock::local_time());
-            for(auto& programme: programmes){
-                auto when = (*programme.next)(now, false);
-                schedule.push(Event(programme.programme_id, when, programme.duration));
+            Event disconnect(programme.station_id, programme_id, now, programme.duration, Event::Type::disconnect);
+            schedule.insert(tick(disconnect.at), disconnect);
+        }
+        programmes[programme_id].reset();
+    }
+
+    static std::string label(const std::string& value){
+        //escaped for the Prometheus text format
+        std::string escaped;
+        for(char c: value){
+            if(c == '\\' || c == '"'){
+                escaped += '\\';
             }
+            if(c == '\n'){
+                escaped += "\\n";
+                continue;
+            }
+            escaped += c;
         }
+        return escaped;
+    }
 
-        while(!schedule.empty()){
-            Event event = schedule.top();
+    void write_metrics() const {
+        //in the Prometheus text format, e.g. for the textfile collector of the node exporter. The file
+        //is replaced at once, so that it is never read half written
+        std::vector<std::pair<const Station*, std::string>> labelled;
+        for(auto& station: stations){
+            if(station){
+                labelled.emplace_back(station.get(), "station=\"" + label(station->name) + "\",id=\"" + std::to_string(station->id) + "\"");
+            }
+        }
 
-            Programme& programme(programmes.at(event.programme));
-            Station& station(stations.at(programme.station_id));
+        struct Family {
+            const char* name;
+            const char* type;
+            const char* help;
+            std::function<uint64_t(const Station&)> value;
+        };
+        const Family families[] = {
+            {"radioman_received_bytes_total", "counter", "Bytes received from the stream.", [](const Station& station){return station.metrics.received_bytes.get();}},
+            {"radioman_reconnects_total", "counter", "Transfers of the stream which ended and were started again.", [](const Station& station){return station.metrics.reconnects.get();}},
+            {"radioman_receive_pauses_total", "counter", "Times receiving was paused because writing fell behind.", [](const Station& station){return station.receive_pauses();}},
+            {"radioman_discarded_bytes_total", "counter", "Bytes discarded because writing fell behind for too long.", [](const Station& station){return station.discarded_bytes();}},
+            {"radioman_written_bytes_total", "counter", "Bytes written to recordings, once per recording.", [](const Station& station){return station.metrics.written_bytes.get();}},
+            {"radioman_recordings_total", "counter", "Recordings started.", [](const Station& station){return station.metrics.recordings.get();}},
+            {"radioman_sinks", "gauge", "Recordings being written.", [](const Station& station){return station.metrics.sinks.get();}},
+            {"radioman_byte_rate", "gauge", "Bytes per second of the stream, measured over the last minute.", [](const Station& station){return station.metrics.byte_rate.get();}},
+            {"radioman_connected", "gauge", "Whether the stream is being received.", [this](const Station& station){return uint64_t(connected[station.id]);}}
+        };
+        struct HistogramFamily {
+            const char* name;
+            const char* help;
+            Histogram StationMetrics::* histogram;
+        };
+        const HistogramFamily histograms[] = {
+            {"radioman_stall_seconds", "Periods of more than a second without data from the stream.", &StationMetrics::stall_seconds},
+            {"radioman_write_seconds", "Duration of writes to the recordings.", &StationMetrics::write_seconds},
+            {"radioman_start_delay_seconds", "Time from the start of a programme to the first byte written.", &StationMetrics::start_delay_seconds}
+        };
+        struct QuantilesFamily {
+            const char* name;
+            const char* help;
+            Quantiles StationMetrics::* quantiles;
+        };
+        const QuantilesFamily summaries[] = {
+            {"radioman_start_skew_seconds", "Time from the start of a programme to the arrival of its first byte, over the latest 256 recordings.", &StationMetrics::start_skew_seconds}
+        };
+
+        std::string temporary = metrics_path + ".tmp";
+        std::ofstream out(temporary, std::ios::trunc);
+        for(auto& family: families){
+            out << "# HELP " << family.name << " " << family.help << "\n# TYPE " << family.name << " " << family.type << "\n";
+            for(auto& station: labelled){
+                out << family.name << "{" << station.second << "} " << family.value(*station.first) << "\n";
+            }
+        }
+        for(auto& family: histograms){
+            out << "# HELP " << family.name << " " << family.help << "\n# TYPE " << family.name << " histogram\n";
+            for(auto& station: labelled){
+                (station.first->metrics.*family.histogram).print(out, family.name, station.second);
+            }
+        }
+        for(auto& family: summaries){
+            out << "# HELP " << family.name << " " << family.help << "\n# TYPE " << family.name << " summary\n";
+            for(auto& station: labelled){
+                (station.first->metrics.*family.quantiles).print(out, family.name, station.second);
+            }
+        }
+        out.close();
+        if(!out || std::rename(temporary.c_str(), metrics_path.c_str()) != 0){
+            std::cout << "[ERR] writing metrics to " << metrics_path << " failed: " << std::strerror(errno) << std::endl;
+        }
+    }
 
-            boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
-            auto diff = (event.time - now);
-            if(diff.total_microseconds() > 0){
-                //std::cout << "sleeping for " << diff << " for " << station.name << "-" << programme.name << std::endl;
-                std::cout << event.time << " SLEEP " << station.name << "-" << programme.name << " for " << diff << std::endl;
-                std::this_thread::sleep_for(std::chrono::microseconds(diff.total_microseconds()));
+    static bool read_rates(const std::string& path, std::unordered_map<std::string, double>& rates){
+        //bytes per second of stations, from lines of a station's name and its bitrate in kbit/s, or from
+        //the radioman_byte_rate samples of a metrics file written earlier
+        std::ifstream in(path);
+        if(!in){
+            std::cerr << "reading " << path << " failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        const std::string measured("radioman_byte_rate{");
+        std::string line;
+        for(size_t number = 1; std::getline(in, line); ++number){
+            if(line.empty() || line[0] == '#'){
+                continue;
+            }
+            std::string name;
+            std::string value;
+            if(line.compare(0, measured.size(), measured) == 0){
+                size_t label = line.find("station=\"");
+                size_t end = line.rfind("} ");
+                if(label == std::string::npos || end == std::string::npos){
+                    std::cerr << path << ":" << number << ": no station in the sample" << std::endl;
+                    return false;
+                }
+                for(size_t i = label + 9; i < end && line[i] != '"'; ++i){
+                    if(line[i] == '\\' && i + 1 < end){
+                        name += line[++i] == 'n' ? '\n' : line[i];
+                        continue;
+                    }
+                    name += line[i];
+                }
+                value = line.substr(end + 2);
+            }
+            else {
+                size_t split = line.find_last_of(" \t");
+                if(split == std::string::npos){
+                    std::cerr << path << ":" << number << ": expected a station and its bitrate in kbit/s" << std::endl;
+                    return false;
+                }
+                name = line.substr(0, line.find_last_not_of(" \t", split) + 1);
+                value = line.substr(split + 1);
+            }
+
+            char* end;
+            double rate = std::strtod(value.c_str(), &end);
+            if(value.empty() || *end != '\0' || rate < 0){
+                std::cerr << path << ":" << number << ": invalid rate '" << value << "'" << std::endl;
+                return false;
+            }
+            rates[name] = line.compare(0, measured.size(), measured) == 0 ? rate : rate * 1000 / 8;
+        }
+        return true;
+    }
+
+    static std::string size(double bytes){
+        std::ostringstream out;
+        const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB"};
+        size_t unit = 0;
+        for(; bytes >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0]); ++unit){
+            bytes /= 1024;
+        }
+        out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+        return out.str();
+    }
+
+    static uint64_t tick(const boost::posix_time::ptime& time){
+        //whole seconds since the epoch, in local time like the schedules
+        return (time - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1))).total_seconds();
+    }
+
+    static boost::posix_time::ptime from_tick(uint64_t tick){
+        if(tick == ~uint64_t(0)){
+            return boost::posix_time::pos_infin;
+        }
+        return boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1)) + boost::posix_time::seconds(tick);
+    }
+
+    bool wait(const boost::posix_time::ptime& until){
+        //until the local time `until`, until work is posted or SIGHUP is received, returns true for the latter
+        itimerspec spec{};
+        if(!until.is_special()){
+            //timerfd expects UTC, the offset is looked up every time because of daylight saving time
+            boost::posix_time::ptime utc = boost::posix_time::second_clock::universal_time();
+            boost::posix_time::time_duration offset = boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(utc) - utc;
+            boost::posix_time::time_duration since_epoch = until - offset - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1));
+            spec.it_value.tv_sec = since_epoch.total_seconds();
+            spec.it_value.tv_nsec = (since_epoch.total_microseconds() % 1000000) * 1000;
+        }
+        //a step of the clock cancels the timer, the caller recomputes the deadline then
+        if(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr) < 0){
+            std::cout << "[ERR] scheduler timerfd_settime: " << std::strerror(errno) << std::endl;
+        }
+
+        pollfd fds[3] = {{timer_fd, POLLIN, 0}, {event_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+        if(poll(fds, 3, -1) < 0 && errno != EINTR){
+            std::cout << "[ERR] scheduler poll: " << std::strerror(errno) << std::endl;
+        }
+        uint64_t value;
+        if(fds[0].revents & POLLIN){
+            //fails with ECANCELED after a step of the clock
+            if(read(timer_fd, &value, sizeof(value)) < 0 && errno != ECANCELED){
+                std::cout << "[ERR] scheduler timerfd: " << std::strerror(errno) << std::endl;
+            }
+        }
+        if(fds[1].revents & POLLIN){
+            if(read(event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN){
+                std::cout << "[ERR] scheduler eventfd: " << std::strerror(errno) << std::endl;
+            }
+        }
+        bool hangup = false;
+        if(fds[2].revents & POLLIN){
+            signalfd_siginfo info;
+            while(read(signal_fd, &info, sizeof(info)) == sizeof(info)){
+                hangup = true;
+            }
+        }
+        return hangup;
+    }
+
+    void handle(const Event& event){
+        if(event.type == Event::Type::disconnect){
+            //unless another programme is still being recorded or about to begin
+            if(connected[event.station] && busy_until[event.station] <= event.time && !upcoming(event.station, event.time)){
+                connected[event.station] = false;
+                downloaders[event.station % downloaders.size()]->disconnect(*stations[event.station]);
+            }
+            return;
+        }
+        if(!programmes[event.programme]){
+            //removed by a reload after the event was due already
+            return;
+        }
+
+        Programme& programme(*programmes[event.programme]);
+        Station& station(*stations[programme.station_id]);
+
+        if(event.type == Event::Type::connect){
+            connect(station);
+            return;
+        }
+        std::string prefixPath = destinationPath + "/" + station.name + "-" + programme.name;
+
+        boost::filesystem::path dir(prefixPath);
+        boost::filesystem::create_directories(prefixPath);
+
+        //before the stream has been looked at, it is most likely MP3
+        std::string extension = Framer::extension(station.codec());
+        std::string stem = prefixPath + "/" + station.name + "-" + programme.name + "-" + boost::posix_time::to_iso_extended_string(event.time);
+        std::string targetPath = stem + "." + extension;
+        //readable as well, recordings lying within this one are copied from it
+        int destination = open(targetPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if(destination < 0){
+            std::cout << "[ERR] " << targetPath << ": " << std::strerror(errno) << std::endl;
+        }
+        else {
+            //the segments and their index.m3u8 go into a directory named like the recording
+            std::unique_ptr<Segments> segments;
+            boost::system::error_code error;
+            if(hls_segment.total_seconds() > 0 && !boost::filesystem::create_directories(stem, error) && error){
+                std::cout << "[ERR] " << stem << ": " << error.message() << std::endl;
             }
+            else if(hls_segment.total_seconds() > 0){
+                segments = std::make_unique<Segments>(stem, extension, hls_segment);
+            }
+            //titles go next to the recording, if the station sends any
+            station.attach(Sink(event.time, event.time + programme.duration, destination, std::move(segments), stem + ".titles"));
+        }
 
-            std::string prefixPath = destinationPath + "/" + station.name + "-" + programme.name;
+        std::cout << event.time << " START " << station.name << "-" << programme.name << " for " << programme.duration << std::endl;
 
-            boost::filesystem::path dir(prefixPath);
-            boost::filesystem::create_directories(prefixPath);
+        busy_until[station.id] = std::max(busy_until[station.id], event.time + programme.duration);
+        if(on_demand){
+            //the sink may wait a moment for the end of the last frame
+            boost::posix_time::ptime end = event.time + programme.duration + boost::posix_time::seconds(2);
+            Event disconnect(station.id, event.programme, end, event.duration, Event::Type::disconnect);
+            schedule.insert(tick(disconnect.at), disconnect);
+        }
 
-            std::string targetPath = prefixPath + "/" + station.name + "-" + programme.name + "-" + boost::posix_time::to_iso_extended_string(event.time) + ".mp3";
-            std::unique_ptr<std::ofstream> ofs(std::make_unique<std::ofstream>(targetPath, std::ofstream::out | std::ofstream::app));
-            station.attach(Sink(event.time + programme.duration, std::move(ofs)));
+        push(event.programme, (*programme.next)(event.time, true));
+    }
 
-            std::cout << event.time << " START " << station.name << "-" << programme.name << " for " << programme.duration << std::endl;
+    void push(size_t programme_id, const boost::posix_time::ptime& when){
+        //schedules the next start of a programme and, with on demand connections, its warm-up
+        Programme& programme(*programmes.at(programme_id));
+        next_start[programme_id] = when;
+        if(when.is_special()){
+            return;
+        }
+        Event start(programme.station_id, programme_id, when, programme.duration);
+        start_events[programme_id] = schedule.insert(tick(start.at), start);
+        if(on_demand){
+            Event connect(programme.station_id, programme_id, when - warm_up, programme.duration, Event::Type::connect);
+            connect_events[programme_id] = schedule.insert(tick(connect.at), connect);
+        }
+    }
 
-            schedule.pop();
+    void connect(Station& station){
+        if(!connected[station.id]){
+            connected[station.id] = true;
+            downloaders[station.id % downloaders.size()]->connect(station);
+        }
+    }
 
-            auto when = (*programme.next)(event.time, true);
-            schedule.push(Event(event.programme, when, event.duration));
+    bool upcoming(size_t station_id, const boost::posix_time::ptime& time) const {
+        //whether a programme of the station begins within the warm-up after `time`
+        for(auto programme_id: station_programmes[station_id]){
+            const auto& when = next_start[programme_id];
+            if(!when.is_special() && when - warm_up <= time){
+                return true;
+            }
         }
+        return false;
     }
 };
 
+static bool parse_time(const std::string& text, boost::posix_time::ptime& time){
+    //"2024-01-31" or "2024-01-31 18:30:00", local time like the schedules
+    try {
+        time = text.find(' ') == std::string::npos ? boost::posix_time::ptime(boost::gregorian::from_simple_string(text)) : boost::posix_time::time_from_string(text);
+    }
+    catch(const std::exception&){
+        return false;
+    }
+    return !time.is_special();
+}
+
 int main(int argc, const char* argv[]){
+    if(argc >= 2 && std::string(argv[1]) == "--forecast"){
+        boost::posix_time::ptime from;
+        boost::posix_time::ptime to;
+        if(argc < 5 || argc > 6 || !parse_time(argv[3], from) || !parse_time(argv[4], to) || to <= from){
+            std::cout << "usage: " << argv[0] << " --forecast configuration_path from until [bitrates_path]" << std::endl;
+            return -1;
+        }
+        Scheduler scheduler;
+        if(scheduler.readConfig(argv[2], true) != EXIT_SUCCESS){
+            std::cout << "parsing configuration file " << argv[2] << " failed.\nexiting" << std::endl;
+            return -1;
+        }
+        return scheduler.forecast(from, to, argc == 6 ? argv[5] : "");
+    }
     if(argc != 2){
-        std::cout << "usage: " << argv[0] << " configuration_path" << std::endl;
+        std::cout << "usage: " << argv[0] << " configuration_path\n       " << argv[0] << " --forecast configuration_path from until [bitrates_path]" << std::endl;
         return -1;
     }
 
@@ -0,0 +1,554 @@
+#include "stream.h"
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+    // `count` frames with the given header and zeros as their payload, appended to `stream`.
+    // Their offsets are added to `starts`
+    void frames(std::string& stream, std::vector<size_t>& starts, const std::string& header, size_t length, size_t count){
+        for(size_t i = 0; i < count; ++i){
+            starts.push_back(stream.size());
+            stream += header;
+            stream.append(length - header.size(), '\0');
+        }
+    }
+
+    // feeds `stream` to `framer` in pieces of `piece` bytes and asserts that it reports the first
+    // frame of `starts` in every piece which lies within one of the `synchronized` ranges
+    void feed(Framer& framer, const std::string& stream, size_t piece, const std::vector<size_t>& starts, const std::vector<std::pair<size_t, size_t>>& synchronized, bool discontinuity = false){
+        for(size_t begin = 0; begin < stream.size(); begin += piece){
+            size_t size = std::min(piece, stream.size() - begin);
+            size_t first = framer.feed(stream.data() + begin, size, discontinuity && begin == 0);
+            for(auto& range: synchronized){
+                if(begin >= range.first && begin + size <= range.second){
+                    auto start = std::lower_bound(starts.begin(), starts.end(), begin);
+                    assert(first == (start != starts.end() && *start < begin + size ? *start - begin : size));
+                }
+            }
+        }
+    }
+
+    // splits `stream` in pieces of `piece` bytes, appending the audio to `audio` and the new
+    // titles with their offset in the audio to `titles`
+    void demux(IcyDemuxer& demuxer, std::string stream, size_t piece, std::string& audio, std::vector<std::pair<size_t, std::string>>& titles){
+        for(size_t begin = 0; begin < stream.size(); begin += piece){
+            size_t before = audio.size();
+            for(auto& run: demuxer.split(&stream[begin], std::min(piece, stream.size() - begin))){
+                audio.append(static_cast<const char*>(run.iov_base), run.iov_len);
+            }
+            if(demuxer.titled){
+                titles.emplace_back(before + demuxer.title_offset, demuxer.title);
+                demuxer.titled = false;
+            }
+        }
+    }
+
+    // `audio` followed by a metadata block holding `meta`, padded to a multiple of 16 bytes
+    std::string icy(const std::string& audio, const std::string& meta){
+        std::string block = audio;
+        block += char((meta.size() + 15) / 16);
+        block += meta;
+        block.append((16 - meta.size() % 16) % 16, '\0');
+        return block;
+    }
+
+    // hands pieces of the links' streams to a Merger through a ChunkRing like the Downloader and
+    // the Writer do, collecting what is recorded
+    struct Merging {
+        ChunkRing ring;
+        Merger merger;
+        std::chrono::system_clock::time_point now;
+        std::string recorded;
+        size_t discontinuities; // of the recorded chunks
+
+        explicit Merging(size_t links):
+            ring(64),
+            merger(ring, links, std::chrono::seconds(5)),
+            now(),
+            recorded(),
+            discontinuities(0)
+        {}
+
+        void receive(size_t link, const std::string& data, bool discontinuity = false){
+            now += std::chrono::milliseconds(10);
+            iovec run{const_cast<char*>(data.data()), data.size()};
+            bool was_empty;
+            bool pushed = ring.push(&run, data.size(), now, discontinuity, link, nullptr, 0, was_empty);
+            assert(pushed);
+            (void)pushed;
+            std::vector<Chunk*> chunks;
+            merger.take(ring.pop(), chunks, "test");
+            collect(chunks);
+        }
+
+        void check(){
+            std::vector<Chunk*> chunks;
+            merger.check(now, chunks, "test");
+            collect(chunks);
+        }
+
+        void collect(const std::vector<Chunk*>& chunks){
+            for(auto chunk: chunks){
+                recorded.append(chunk->data, chunk->size);
+                discontinuities += chunk->discontinuity;
+                ring.release(chunk);
+            }
+        }
+    };
+
+    std::string noise(size_t size, unsigned seed){
+        std::mt19937 random(seed);
+        std::string data(size, '\0');
+        for(auto& c: data){
+            c = char(random());
+        }
+        return data;
+    }
+}
+
+int main(){
+    {
+        std::cout << "=== TEST framer (codecs) ===\n\n";
+
+        // MPEG-1 layer 3 and 2 at 128 and 160 kbit/s, ADTS and an Ogg page of 2 segments
+        const std::string mp3("\xFF\xFB\x90\x64", 4);
+        const std::string mp2("\xFF\xFD\x90\x04", 4);
+        const std::string aac("\xFF\xF1\x50\x80\x2A\x5F\xFC", 7); // 338 bytes
+        std::string ogg("OggS", 5);
+        ogg.append(21, '\0');
+        ogg += "\x02\xFF\x0A";
+        const std::pair<std::string, size_t> streams[] = {{mp3, 417}, {mp2, 522}, {aac, 338}, {ogg, 27 + 2 + 255 + 10}};
+        const Framer::Codec codecs[] = {Framer::Codec::mp3, Framer::Codec::mp2, Framer::Codec::aac, Framer::Codec::ogg};
+
+        for(int i = 0; i < 4; ++i){
+            std::string stream(100, 'x');
+            std::vector<size_t> starts;
+            frames(stream, starts, streams[i].first, streams[i].second, 8);
+
+            Framer framer;
+            assert(framer.codec() == Framer::Codec::unknown);
+            feed(framer, stream, stream.size(), starts, {{0, stream.size()}});
+            assert(framer.codec() == codecs[i]);
+        }
+        assert(std::string(Framer::extension(Framer::Codec::aac)) == "aac");
+        assert(std::string(Framer::extension(Framer::Codec::unknown)) == "mp3");
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST framer (headers across pieces) ===\n\n";
+
+        const std::string mp3("\xFF\xFB\x90\x64", 4);
+        std::string stream(100, 'x');
+        std::vector<size_t> starts;
+        frames(stream, starts, mp3, 417, 40);
+
+        // once the second frame has been seen every piece is reported correctly
+        for(size_t piece: {1, 2, 3, 7, 416, 417, 418, 1000, 4096}){
+            Framer framer;
+            feed(framer, stream, piece, starts, {{starts[1], stream.size()}});
+            assert(framer.codec() == Framer::Codec::mp3);
+        }
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST framer (resynchronization) ===\n\n";
+
+        const std::string mp3("\xFF\xFB\x90\x64", 4);
+        std::string stream(100, 'x');
+        std::vector<size_t> starts;
+        frames(stream, starts, mp3, 417, 10);
+        // a damaged frame, its header is valid but its length is not
+        size_t damaged = stream.size();
+        stream += mp3;
+        stream.append(200, '\0');
+        stream.append(300, 'y');
+        size_t resumed = stream.size();
+        frames(stream, starts, mp3, 417, 10);
+
+        for(size_t piece: {1, 5, 417, 1000}){
+            Framer framer;
+            feed(framer, stream, piece, starts, {{starts[1], damaged}, {resumed + 417, stream.size()}});
+        }
+
+        // a new transfer begins anywhere, the previous one ended in the middle of a frame
+        std::string first(50, 'x');
+        std::vector<size_t> first_starts;
+        frames(first, first_starts, mp3, 417, 5);
+        first.resize(first.size() - 200);
+        std::string second(33, 'z');
+        std::vector<size_t> second_starts;
+        frames(second, second_starts, mp3, 417, 5);
+
+        Framer framer;
+        feed(framer, first, first.size(), first_starts, {{0, first.size()}});
+        feed(framer, second, second.size(), second_starts, {{0, second.size()}}, true);
+        feed(framer, second, 100, second_starts, {{0, second.size()}}, true);
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST icy (metadata across pieces) ===\n\n";
+
+        const std::string audio = "0123456789abcdef";
+        std::string stream = icy(audio, "StreamTitle='A - B';StreamUrl='x';")
+            + icy(audio, "")
+            + icy(audio, "StreamTitle='It's';")
+            + icy(audio, "StreamTitle='It's';")
+            + icy(audio, "StreamTitle='C")
+            + "tail";
+
+        // a piece of up to 17 bytes completes at most one titled block
+        for(size_t piece = 1; piece <= 17; ++piece){
+            IcyDemuxer demuxer;
+            demuxer.reset(audio.size());
+            std::string received;
+            std::vector<std::pair<size_t, std::string>> titles;
+            demux(demuxer, stream, piece, received, titles);
+            assert(received == audio + audio + audio + audio + audio + "tail");
+            // unchanged titles are not repeated, an unterminated one ends at the padding
+            assert((titles == std::vector<std::pair<size_t, std::string>>{{16, "A - B"}, {48, "It's"}, {80, "C"}}));
+        }
+
+        // of several in one piece the last one is kept
+        IcyDemuxer demuxer;
+        demuxer.reset(audio.size());
+        std::string received;
+        std::vector<std::pair<size_t, std::string>> titles;
+        demux(demuxer, stream, stream.size(), received, titles);
+        assert((titles == std::vector<std::pair<size_t, std::string>>{{80, "C"}}));
+
+        // a new response begins with audio, without metadata it is passed on as it is
+        received.clear();
+        titles.clear();
+        demuxer.reset(audio.size());
+        demux(demuxer, icy(audio, "StreamTitle='D';") + audio, 5, received, titles);
+        assert(received == audio + audio);
+        assert((titles == std::vector<std::pair<size_t, std::string>>{{16, "D"}}));
+        demuxer.reset(0);
+        received.clear();
+        demux(demuxer, stream, 7, received, titles);
+        assert(received == stream);
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST merger (failover on a reconnect) ===\n\n";
+
+        // link 1 is ahead and cut differently, it continues right after the end of link 0
+        const std::string stream = noise(300000, 1);
+        Merging merging(2);
+        size_t received[2] = {0, 0};
+        while(received[0] < 50000){
+            merging.receive(1, stream.substr(received[1], 1300));
+            received[1] += 1300;
+            merging.receive(0, stream.substr(received[0], 1000));
+            received[0] += 1000;
+        }
+        assert(merging.recorded == stream.substr(0, 50000));
+
+        // link 0 reconnects after link 1 received more
+        merging.receive(1, stream.substr(received[1], 1300));
+        received[1] += 1300;
+        merging.receive(0, stream.substr(120000, 1000), true);
+        assert(merging.recorded == stream.substr(0, received[1]));
+        for(int i = 0; i < 40; ++i){
+            merging.receive(0, stream.substr(121000 + 1000 * i, 1000));
+            merging.receive(1, stream.substr(received[1], 1300));
+            received[1] += 1300;
+        }
+        assert(merging.recorded == stream.substr(0, received[1]));
+        assert(merging.discontinuities == 0);
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST merger (waiting for a link behind) ===\n\n";
+
+        const std::string stream = noise(300000, 2);
+        Merging merging(2);
+        size_t received[2] = {0, 0};
+        while(received[0] < 50000){
+            merging.receive(0, stream.substr(received[0], 1000));
+            received[0] += 1000;
+            merging.receive(1, stream.substr(received[1], 900));
+            received[1] += 900;
+        }
+        merging.receive(0, stream.substr(100000, 1000), true);
+        assert(merging.recorded == stream.substr(0, 50000));
+
+        // it catches up before its backlog is exceeded
+        while(received[1] < 60000){
+            merging.receive(1, stream.substr(received[1], 900));
+            received[1] += 900;
+            assert(merging.recorded == stream.substr(0, std::max<size_t>(received[1], 50000)));
+        }
+        assert(merging.discontinuities == 0);
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST merger (links which can not be aligned) ===\n\n";
+
+        const std::string stream = noise(100000, 3);
+        const std::string other = noise(100000, 4);
+        Merging merging(2);
+        size_t received = 0;
+        for(; received < 50000; received += 1000){
+            merging.receive(0, stream.substr(received, 1000));
+            merging.receive(1, other.substr(received, 1000));
+        }
+        merging.receive(0, stream.substr(70000, 1000), true);
+        assert(merging.recorded == stream.substr(0, 50000));
+
+        // after a backlog of chunks the newest one is taken, the recording has a gap
+        for(; merging.recorded.size() == 50000; received += 1000){
+            merging.receive(1, other.substr(received, 1000));
+        }
+        assert(received == 50000 + 16 * 1000);
+        assert(merging.recorded == stream.substr(0, 50000) + other.substr(received - 1000, 1000));
+        assert(merging.discontinuities == 1);
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST merger (failover on a stall) ===\n\n";
+
+        const std::string stream = noise(300000, 5);
+        Merging merging(2);
+        size_t received[2] = {0, 0};
+        while(received[0] < 50000){
+            merging.receive(1, stream.substr(received[1], 1300));
+            received[1] += 1300;
+            merging.receive(0, stream.substr(received[0], 1000));
+            received[0] += 1000;
+        }
+        auto last = merging.now;
+        for(int i = 0; i < 3; ++i){
+            merging.receive(1, stream.substr(received[1], 1300));
+            received[1] += 1300;
+        }
+
+        merging.now = last + std::chrono::seconds(5);
+        merging.check();
+        assert(merging.recorded == stream.substr(0, 50000));
+        merging.now += std::chrono::milliseconds(1);
+        merging.check();
+        assert(merging.recorded == stream.substr(0, received[1]));
+        merging.receive(1, stream.substr(received[1], 1300));
+        received[1] += 1300;
+        assert(merging.recorded == stream.substr(0, received[1]));
+        assert(merging.discontinuities == 0);
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST wheel (due timers and sub-second starts) ===\n\n";
+
+        TimerWheel<int> wheel(1000);
+        assert(wheel.empty());
+        assert(wheel.next() == ~uint64_t(0));
+
+        // events within the current second are due right away, the Scheduler
+        // keeps them until their exact time
+        wheel.insert(1000, 1);
+        wheel.insert(999, 2);
+        assert(wheel.next() == 1000);
+        std::vector<int> due;
+        wheel.advance(1000, due);
+        std::sort(due.begin(), due.end());
+        assert((due == std::vector<int>{1, 2}));
+        assert(wheel.empty());
+
+        wheel.insert(1001, 3);
+        due.clear();
+        wheel.advance(1000, due);
+        assert(due.empty());
+        wheel.advance(1001, due);
+        assert((due == std::vector<int>{3}));
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST wheel (next at coarse levels) ===\n\n";
+
+        TimerWheel<int> wheel(100);
+        wheel.insert(5000, 1);
+
+        // on level 2 only the start of its slot is known, then it moves down
+        std::vector<int> due;
+        assert(wheel.next() == 4096);
+        wheel.advance(wheel.next(), due);
+        assert(due.empty());
+        assert(wheel.next() == 4096 + (14 << 6));
+        wheel.advance(wheel.next(), due);
+        assert(due.empty());
+        assert(wheel.next() == 5000);
+        wheel.advance(wheel.next(), due);
+        assert((due == std::vector<int>{1}));
+
+        // from the top level down, one step per level
+        TimerWheel<int> far(5);
+        uint64_t tick = 0;
+        for(uint64_t level = 0; level < 6; ++level){
+            tick |= (level + 1) << (6 * level);
+        }
+        far.insert(tick, 2);
+        assert(far.next() == uint64_t(6) << 30);
+        due.clear();
+        int steps = 0;
+        for(; due.empty(); ++steps){
+            far.advance(far.next(), due);
+        }
+        assert(steps == 6);
+        assert((due == std::vector<int>{2}));
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST wheel (cascading when a level wraps) ===\n\n";
+
+        // slot 63 of level 0 is the last, the next second lies in the next slot of level 1
+        TimerWheel<int> wheel(63);
+        wheel.insert(64, 1);
+        wheel.insert(64 * 64, 2);
+        wheel.insert(64 * 64 + 64 + 1, 3);
+        std::vector<int> due;
+        assert(wheel.next() == 64);
+        wheel.advance(64, due);
+        assert((due == std::vector<int>{1}));
+
+        // the last second of level 1 wraps into level 2
+        due.clear();
+        wheel.advance(64 * 64 - 1, due);
+        assert(due.empty());
+        assert(wheel.next() == 64 * 64);
+        wheel.advance(64 * 64, due);
+        assert((due == std::vector<int>{2}));
+
+        // several levels are passed at once
+        due.clear();
+        wheel.advance(uint64_t(1) << 30, due);
+        assert((due == std::vector<int>{3}));
+        assert(wheel.empty());
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST wheel (cancel checks the generation) ===\n\n";
+
+        TimerWheel<int> wheel(0);
+        assert(!wheel.cancel(TimerWheel<int>::invalid));
+
+        TimerWheel<int>::Handle first = wheel.insert(200, 1);
+        assert(wheel.cancel(first));
+        assert(!wheel.cancel(first));
+        assert(wheel.empty());
+
+        // the node is reused, the old handle does not refer to the new timer
+        TimerWheel<int>::Handle second = wheel.insert(300, 2);
+        assert((second & 0xFFFFFFFFu) == (first & 0xFFFFFFFFu));
+        assert(second != first);
+        assert(!wheel.cancel(first));
+        assert(!wheel.empty());
+
+        // due timers can not be cancelled anymore
+        std::vector<int> due;
+        wheel.advance(300, due);
+        assert((due == std::vector<int>{2}));
+        assert(!wheel.cancel(second));
+
+        std::cout << "OK\n\n";
+    }
+
+    {
+        std::cout << "=== TEST wheel (random operations against a multimap) ===\n\n";
+
+        std::mt19937_64 random(12);
+        uint64_t now = 1500000000;
+        TimerWheel<uint64_t> wheel(now);
+        std::map<uint64_t, uint64_t> timers; // id to tick
+        std::map<uint64_t, TimerWheel<uint64_t>::Handle> handles;
+        const uint64_t spans[] = {2, 70, 5000, 300000, uint64_t(1) << 26, uint64_t(1) << 34};
+
+        for(uint64_t id = 0; id < 200000; ++id){
+            uint64_t span = spans[random() % 6];
+            switch(random() % 4){
+                case 0:
+                case 1: {
+                    uint64_t tick = now - 1 + random() % span;
+                    handles[id] = wheel.insert(tick, id);
+                    timers[id] = tick;
+                    break;
+                }
+                case 2: {
+                    if(handles.empty()){
+                        break;
+                    }
+                    auto it = handles.lower_bound(random() % id);
+                    if(it == handles.end()){
+                        it = handles.begin();
+                    }
+                    assert(wheel.cancel(it->second));
+                    assert(!wheel.cancel(it->second));
+                    timers.erase(it->first);
+                    handles.erase(it);
+                    break;
+                }
+                default: {
+                    uint64_t earliest = ~uint64_t(0);
+                    for(auto& timer: timers){
+                        earliest = std::min(earliest, timer.second);
+                    }
+                    uint64_t next = wheel.next();
+                    assert(next <= std::max(earliest, now));
+                    assert(next >= now);
+
+                    // to the next timer or beyond it
+                    uint64_t to = random() % 2 ? std::max(next, now) : now + random() % span;
+                    std::vector<uint64_t> due;
+                    wheel.advance(to, due);
+                    now = std::max(now, to);
+                    std::sort(due.begin(), due.end());
+                    std::vector<uint64_t> expected;
+                    for(auto it = timers.begin(); it != timers.end(); ){
+                        if(it->second <= now){
+                            expected.push_back(it->first);
+                            handles.erase(it->first);
+                            it = timers.erase(it);
+                        }
+                        else {
+                            ++it;
+                        }
+                    }
+                    assert(due == expected);
+                }
+            }
+            assert(wheel.empty() == timers.empty());
+        }
+
+        std::cout << "OK\n\n";
+    }
+}
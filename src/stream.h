@@ -0,0 +1,711 @@
+#pragma once
+
+#include <curl/curl.h>
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+template <typename T>
+class SpscQueue {
+    //bounded queue between exactly one producer and one consumer thread
+    std::vector<T> slots;
+    //monotonically increasing, the slot is the index modulo slots.size()
+    std::atomic<size_t> head; //written by the producer
+    std::atomic<size_t> tail; //written by the consumer
+
+public:
+    explicit SpscQueue(size_t capacity):
+        slots(capacity),
+        head(0),
+        tail(0)
+    {}
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    bool push(const T& value, bool& was_empty){
+        //returns false if the queue is full. `was_empty` is set if the consumer had
+        //already taken everything before, i.e. if it might be waiting to be woken up
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) == slots.size()){
+            return false;
+        }
+        slots[h % slots.size()] = value;
+
+        //sequentially consistent, pairs with pop() and size() of the consumer
+        head.store(h + 1);
+        was_empty = tail.load() == h;
+        return true;
+    }
+
+    bool pop(T& value){
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(head.load() == t){
+            return false;
+        }
+        value = slots[t % slots.size()];
+        tail.store(t + 1);
+        return true;
+    }
+
+    size_t size() const {
+        //exact for the consumer, a lower bound of the free space for the producer
+        return head.load() - tail.load();
+    }
+};
+
+struct Chunk {
+    //a piece of a station's stream, shared by all sinks writing it
+    std::chrono::system_clock::time_point received;
+    size_t size;
+    bool discontinuity; //first piece of a new transfer
+    size_t link; //connection of the station it has been received on
+    //a new title of the ICY metadata begins at `title_offset`
+    bool titled;
+    size_t title_offset;
+    std::string title;
+    //only touched by the Writer thread
+    size_t frame; //offset of the first frame starting in this piece, `size` if none does
+    unsigned references;
+    char data[CURL_MAX_WRITE_SIZE];
+};
+
+class Framer {
+    //finds the frame boundaries of an MPEG audio, ADTS (AAC) or Ogg stream handed over in pieces.
+    //Once synchronized it only reads the frame headers, searching is left to memchr
+public:
+    enum class Codec { unknown, mp2, mp3, aac, ogg };
+
+    static const char* extension(Codec codec){
+        switch(codec){
+            case Codec::mp2: return "mp2";
+            case Codec::aac: return "aac";
+            case Codec::ogg: return "ogg";
+            default: return "mp3";
+        }
+    }
+
+private:
+    //the longest header is an Ogg page's with 255 segments
+    static const size_t carry_size = 512;
+
+    std::atomic<Codec> detected;
+    bool locked;
+    bool confirmed; //locked and a second frame header has been seen
+    uint64_t position; //stream offset of `data`
+    uint64_t next; //stream offset of the next frame, if locked
+    uint64_t first_frame; //stream offset of the first frame, if locked
+    uint64_t scan; //stream offset to search the next frame from, if not locked
+    //the end of the previous pieces for headers spanning two of them
+    unsigned char carry[carry_size];
+    size_t carry_length;
+    const unsigned char* data;
+    size_t size;
+
+    int at(uint64_t offset) const {
+        //byte at a stream offset or -1 if it has not been received yet
+        if(offset >= position){
+            return offset - position < size ? data[offset - position] : -1;
+        }
+        return position - offset <= carry_length ? carry[carry_length - (position - offset)] : -1;
+    }
+
+    int header(uint64_t offset, Codec& codec, size_t& length) const {
+        //1 if a frame header of `codec` (any if unknown) starts at `offset`, setting codec and
+        //the frame length, -1 if there is none, 0 if that can not be told yet
+        int b[6];
+        for(int i = 0; i < 6; ++i){
+            b[i] = at(offset + i);
+        }
+
+        if(b[0] < 0){
+            return 0;
+        }
+        if(b[0] == 0xFF){
+            if(b[1] < 0 || b[2] < 0){
+                return b[1] < 0 || (b[1] & 0xE0) == 0xE0 ? 0 : -1;
+            }
+            if((b[1] & 0xF6) == 0xF0){
+                //ADTS: 12 bit sync, layer 0
+                if(codec != Codec::unknown && codec != Codec::aac){
+                    return -1;
+                }
+                if(((b[2] >> 2) & 0xF) >= 13){
+                    return -1;
+                }
+                if(b[5] < 0){
+                    return 0;
+                }
+                length = ((b[3] & 0x3) << 11) | (b[4] << 3) | (b[5] >> 5);
+                codec = Codec::aac;
+                return length >= 7 ? 1 : -1;
+            }
+            if((b[1] & 0xE0) == 0xE0){
+                //MPEG audio: 11 bit sync
+                static const unsigned short bitrates[2][3][16] = {
+                    {
+                        {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+                        {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+                        {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0}
+                    },
+                    {
+                        {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+                        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+                        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0}
+                    }
+                };
+                static const unsigned short samplerates[4][3] = {
+                    {11025, 12000, 8000}, {0, 0, 0}, {22050, 24000, 16000}, {44100, 48000, 32000}
+                };
+
+                int version = (b[1] >> 3) & 0x3;
+                int layer = 4 - ((b[1] >> 1) & 0x3);
+                int bitrate_index = b[2] >> 4;
+                int samplerate_index = (b[2] >> 2) & 0x3;
+                int padding = (b[2] >> 1) & 0x1;
+                //reserved values, free format is not supported
+                if(version == 1 || layer == 4 || bitrate_index == 0 || bitrate_index == 15 || samplerate_index == 3){
+                    return -1;
+                }
+                Codec found = layer == 3 ? Codec::mp3 : Codec::mp2;
+                if(codec != Codec::unknown && codec != found){
+                    return -1;
+                }
+
+                unsigned long bitrate = bitrates[version == 3 ? 0 : 1][layer - 1][bitrate_index] * 1000ul;
+                unsigned long samplerate = samplerates[version][samplerate_index];
+                if(layer == 1){
+                    length = (12 * bitrate / samplerate + padding) * 4;
+                }
+                else {
+                    length = (layer == 3 && version != 3 ? 72 : 144) * bitrate / samplerate + padding;
+                }
+                codec = found;
+                return 1;
+            }
+            return -1;
+        }
+
+        if(b[0] == 'O'){
+            //Ogg page: "OggS", version 0, 22 more bytes and the segment table
+            const char* magic = "OggS";
+            for(int i = 1; i < 5; ++i){
+                if(b[i] < 0){
+                    return 0;
+                }
+                if(b[i] != (i < 4 ? magic[i] : 0)){
+                    return -1;
+                }
+            }
+            if(codec != Codec::unknown && codec != Codec::ogg){
+                return -1;
+            }
+            int segments = at(offset + 26);
+            if(segments < 0 || at(offset + 26 + segments) < 0){
+                return 0;
+            }
+            length = 27 + segments;
+            for(int i = 0; i < segments; ++i){
+                length += at(offset + 27 + i);
+            }
+            codec = Codec::ogg;
+            return 1;
+        }
+
+        return -1;
+    }
+
+    void synchronize(){
+        //searches the first frame header from `scan` on which is followed by another one
+        Codec codec = detected.load(std::memory_order_relaxed);
+        int syncs[2] = {codec == Codec::ogg ? 'O' : 0xFF, codec == Codec::unknown ? 'O' : -1};
+
+        uint64_t carry_begin = position - carry_length;
+        uint64_t end = position + size;
+        uint64_t from = std::max(scan, carry_begin);
+        while(from < end){
+            //the carried bytes first, then the piece itself
+            const unsigned char* begin = from < position ? carry + (from - carry_begin) : data + (from - position);
+            size_t length = from < position ? position - from : end - from;
+            const unsigned char* candidate = nullptr;
+            for(int sync: syncs){
+                const void* found = sync < 0 ? nullptr : std::memchr(begin, sync, length);
+                if(found != nullptr && (candidate == nullptr || found < candidate)){
+                    candidate = static_cast<const unsigned char*>(found);
+                }
+            }
+            if(candidate == nullptr){
+                from += length;
+                continue;
+            }
+            uint64_t offset = from + (candidate - begin);
+
+            Codec found = codec;
+            size_t frame_length;
+            int valid = header(offset, found, frame_length);
+            if(valid == 0){
+                //continue with more data
+                scan = offset;
+                return;
+            }
+            if(valid > 0){
+                //a following header confirms it. If that has not been received yet, a wrong guess
+                //is noticed at the next frame
+                Codec following = found;
+                size_t following_length;
+                int valid_following = header(offset + frame_length, following, following_length);
+                if(valid_following >= 0){
+                    detected.store(found, std::memory_order_relaxed);
+                    locked = true;
+                    confirmed = valid_following > 0;
+                    next = first_frame = offset;
+                    return;
+                }
+            }
+            from = offset + 1;
+        }
+        scan = end;
+    }
+
+public:
+    Framer():
+        detected(Codec::unknown),
+        locked(false),
+        confirmed(false),
+        position(0),
+        next(0),
+        first_frame(0),
+        scan(0),
+        carry(),
+        carry_length(0),
+        data(nullptr),
+        size(0)
+    {}
+
+    Codec codec() const {
+        //the codec of the stream once it has been found, may be called from any thread
+        return detected.load(std::memory_order_relaxed);
+    }
+
+    size_t feed(const char* piece, size_t piece_size, bool discontinuity){
+        //returns the offset of the first frame starting in the piece, its size if none does
+        //and 0 as long as the frames of the stream are unknown
+        if(discontinuity){
+            locked = false;
+            carry_length = 0;
+            scan = position;
+        }
+        data = reinterpret_cast<const unsigned char*>(piece);
+        size = piece_size;
+        uint64_t end = position + size;
+
+        size_t first = size;
+        while(true){
+            if(!locked){
+                synchronize();
+                if(!locked){
+                    break;
+                }
+            }
+
+            while(next < end){
+                Codec codec = detected.load(std::memory_order_relaxed);
+                size_t length;
+                int valid = next + carry_length < position ? -1 : header(next, codec, length);
+                if(valid < 0){
+                    //lost track or a wrong guess, search again
+                    locked = false;
+                    scan = (confirmed ? next : first_frame) + 1;
+                    break;
+                }
+                confirmed = confirmed || next != first_frame;
+                if(next >= position && first == size){
+                    first = next - position;
+                }
+                if(valid == 0){
+                    break;
+                }
+                next += length;
+            }
+            if(locked){
+                break;
+            }
+        }
+
+        //keep the end for headers spanning into the next piece
+        if(size >= carry_size){
+            std::memcpy(carry, data + size - carry_size, carry_size);
+            carry_length = carry_size;
+        }
+        else {
+            size_t keep = std::min(carry_length, carry_size - size);
+            std::memmove(carry, carry + carry_length - keep, keep);
+            std::memcpy(carry + keep, data, size);
+            carry_length = keep + size;
+        }
+        position = end;
+
+        return first == size && !locked ? 0 : first;
+    }
+};
+
+class IcyDemuxer {
+    //separates the metadata a server interleaves every `interval` bytes of audio when asked with
+    //"Icy-MetaData: 1". The audio is left in place and described by runs, only metadata is copied
+    size_t interval; //0 if the stream has no metadata
+    size_t audio_left; //until the next metadata block
+    size_t meta_left; //of the block being read
+    bool in_meta; //its length byte has been read
+    std::string meta;
+    std::string last; //title handed on last
+    std::vector<iovec> runs;
+
+    void parse(size_t offset){
+        //StreamTitle='Artist - Title';StreamUrl='...'; padded with zeros, empty if unchanged
+        static const char key[] = "StreamTitle='";
+        size_t begin = meta.find(key);
+        if(begin == std::string::npos){
+            return;
+        }
+        begin += sizeof(key) - 1;
+        //titles may contain quotes themselves
+        size_t end = meta.find("';", begin);
+        if(end == std::string::npos){
+            end = meta.find_last_of('\'');
+            end = end == std::string::npos || end < begin ? meta.find('\0', begin) : end;
+        }
+        std::string found = meta.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        if(found != last){
+            last = found;
+            title.swap(found);
+            titled = true;
+            title_offset = offset;
+        }
+    }
+
+public:
+    //the last new title found and where it begins in the audio of the last split. It stays until
+    //the caller clears `titled`, then it belongs to the beginning of the next audio
+    std::string title;
+    bool titled;
+    size_t title_offset;
+
+    IcyDemuxer():
+        interval(0),
+        audio_left(0),
+        meta_left(0),
+        in_meta(false),
+        meta(),
+        last(),
+        runs(),
+        title(),
+        titled(false),
+        title_offset(0)
+    {}
+
+    void reset(size_t metaint){
+        //a response begins, with metadata every `metaint` bytes or none if 0
+        interval = metaint;
+        audio_left = metaint;
+        in_meta = false;
+        meta.clear();
+    }
+
+    const std::vector<iovec>& split(char* data, size_t size){
+        //returns the runs of audio in `data`
+        runs.clear();
+        title_offset = 0;
+        if(interval == 0){
+            runs.push_back(iovec{data, size});
+            return runs;
+        }
+        size_t audio = 0;
+        while(size > 0){
+            if(audio_left > 0){
+                size_t length = std::min(size, audio_left);
+                runs.push_back(iovec{data, length});
+                audio_left -= length;
+                audio += length;
+                data += length;
+                size -= length;
+                continue;
+            }
+            if(!in_meta){
+                meta_left = static_cast<unsigned char>(*data) * 16;
+                meta.clear();
+                in_meta = true;
+                ++data;
+                --size;
+            }
+            else {
+                size_t length = std::min(size, meta_left);
+                meta.append(data, length);
+                meta_left -= length;
+                data += length;
+                size -= length;
+            }
+            if(meta_left == 0){
+                in_meta = false;
+                audio_left = interval;
+                parse(audio);
+            }
+        }
+        return runs;
+    }
+};
+
+class ChunkRing {
+    //the received data of one station on its way from the Downloader to the Writer thread.
+    //A fixed number of chunks cycles from the producer to the consumer and back
+    std::vector<Chunk> chunks;
+    SpscQueue<Chunk*> unused; //Writer to Downloader
+    SpscQueue<Chunk*> filled; //Downloader to Writer
+
+public:
+    //set by the producer when it paused the transfer because no chunk was left,
+    //cleared by the consumer once it has released some again
+    std::atomic<bool> paused;
+    //number of times the transfer had to be paused (backpressure) and number of
+    //bytes discarded because writing fell behind for longer than the stream could wait
+    std::atomic<unsigned long long> pauses;
+    std::atomic<unsigned long long> overflow_bytes;
+
+    explicit ChunkRing(size_t capacity):
+        chunks(std::max<size_t>(capacity, 2)),
+        unused(chunks.size()),
+        filled(chunks.size()),
+        paused(false),
+        pauses(0),
+        overflow_bytes(0)
+    {
+        for(auto& chunk: chunks){
+            release(&chunk);
+        }
+    }
+    ChunkRing(const ChunkRing&) = delete;
+    ChunkRing& operator=(const ChunkRing&) = delete;
+
+    bool room(size_t size) const {
+        //producer: whether `size` bytes can be pushed
+        return unused.size() >= (size + CURL_MAX_WRITE_SIZE - 1) / CURL_MAX_WRITE_SIZE;
+    }
+
+    bool push(const iovec* runs, size_t size, std::chrono::system_clock::time_point received, bool discontinuity, size_t link, const std::string* title, size_t title_offset, bool& was_empty){
+        //producer: gathers `size` bytes from `runs` into unused chunks and hands them to the consumer,
+        //returns false if there are not enough of them. The title, if any, goes with the chunk it begins in
+        size_t needed = (size + CURL_MAX_WRITE_SIZE - 1) / CURL_MAX_WRITE_SIZE;
+        if(unused.size() < needed){
+            return false;
+        }
+
+        was_empty = false;
+        size_t run_offset = 0;
+        for(size_t i = 0; i < needed; ++i){
+            Chunk* chunk = nullptr;
+            unused.pop(chunk);
+            chunk->received = received;
+            chunk->size = std::min<size_t>(size - i * CURL_MAX_WRITE_SIZE, CURL_MAX_WRITE_SIZE);
+            chunk->discontinuity = discontinuity && i == 0;
+            chunk->link = link;
+            chunk->references = 0;
+            for(size_t copied = 0; copied < chunk->size; ){
+                size_t length = std::min(runs->iov_len - run_offset, chunk->size - copied);
+                std::memcpy(chunk->data + copied, static_cast<const char*>(runs->iov_base) + run_offset, length);
+                copied += length;
+                run_offset += length;
+                if(run_offset == runs->iov_len){
+                    ++runs;
+                    run_offset = 0;
+                }
+            }
+            size_t begin = i * CURL_MAX_WRITE_SIZE;
+            chunk->titled = title != nullptr && title_offset >= begin && (title_offset < begin + chunk->size || i + 1 == needed);
+            if(chunk->titled){
+                chunk->title = *title;
+                chunk->title_offset = title_offset - begin;
+            }
+
+            bool empty = false;
+            filled.push(chunk, empty);
+            was_empty = was_empty || empty;
+        }
+        return true;
+    }
+
+    size_t capacity() const {
+        return chunks.size();
+    }
+
+    size_t size() const {
+        //consumer: number of chunks ready
+        return filled.size();
+    }
+
+    Chunk* pop(){
+        //consumer: oldest chunk not yet taken or nullptr
+        Chunk* chunk = nullptr;
+        filled.pop(chunk);
+        return chunk;
+    }
+
+    void release(Chunk* chunk){
+        //consumer: hands a chunk which is no longer referenced back to the producer
+        bool was_empty;
+        unused.push(chunk, was_empty);
+    }
+};
+
+class Merger {
+    //combines the chunks of a station's redundant links into one stream. Only the data of the
+    //active link is recorded, the recent chunks of the others are held back. When the active link
+    //breaks off or stalls, another one takes over right after the last bytes recorded, so that
+    //nothing is lost or repeated and the frames stay intact. Only used by the Writer thread
+    ChunkRing& ring;
+    const size_t backlog; //chunks held back per link
+    const std::chrono::milliseconds stall; //time without data after which the active link is replaced
+    std::vector<std::deque<Chunk*>> held;
+    std::vector<std::chrono::system_clock::time_point> last_received;
+    size_t active;
+    bool switching; //until the data of the active link has been aligned with what has been recorded
+    size_t waited; //chunks received by the active link while switching
+    //the end of what has been recorded, enough to be unambiguous in compressed audio
+    static const size_t tail_size = 64;
+    char tail[tail_size];
+    size_t tail_length;
+
+    void record(Chunk* chunk, std::vector<Chunk*>& recorded){
+        recorded.push_back(chunk);
+        if(chunk->size >= tail_size){
+            std::memcpy(tail, chunk->data + chunk->size - tail_size, tail_size);
+            tail_length = tail_size;
+        }
+        else {
+            size_t keep = std::min(tail_length, tail_size - chunk->size);
+            std::memmove(tail, tail + tail_length - keep, keep);
+            std::memcpy(tail + keep, chunk->data, chunk->size);
+            tail_length = keep + chunk->size;
+        }
+    }
+
+    void hold(Chunk* chunk){
+        auto& chunks = held[chunk->link];
+        chunks.push_back(chunk);
+        if(chunks.size() > backlog){
+            ring.release(chunks.front());
+            chunks.pop_front();
+        }
+    }
+
+    bool fail_over(std::vector<Chunk*>& recorded, const char* name){
+        //to the link which received last, if it did so after the active one
+        size_t best = active;
+        for(size_t link = 0; link < held.size(); ++link){
+            if(!held[link].empty() && last_received[link] > last_received[best]){
+                best = link;
+            }
+        }
+        if(best == active){
+            return false;
+        }
+        std::cout << "[OK ] " << std::left << std::setw(8) << name << " link " << best << " takes over from link " << active << std::endl;
+        active = best;
+        switching = true;
+        waited = 0;
+        align(recorded, name);
+        return true;
+    }
+
+    void align(std::vector<Chunk*>& recorded, const char* name){
+        //searches the end of the recording in the held back data of the active link, which is rare enough to copy
+        auto& chunks = held[active];
+        std::string data;
+        for(auto chunk: chunks){
+            data.append(chunk->data, chunk->size);
+        }
+        //with nothing recorded yet, all of it is taken
+        size_t found = tail_length == 0 ? 0 : data.find(std::string(tail, tail_length));
+        if(found == std::string::npos){
+            if(waited < backlog){
+                //the link may be behind, wait for more
+                return;
+            }
+            //too far ahead or a different stream, continue with its newest data
+            std::cout << "[ERR] " << std::left << std::setw(8) << name << " links could not be aligned, the recording has a gap" << std::endl;
+            while(chunks.size() > 1){
+                ring.release(chunks.front());
+                chunks.pop_front();
+            }
+            chunks.front()->discontinuity = true;
+        }
+        else {
+            //drop what has been recorded already
+            size_t skip = found + tail_length;
+            while(!chunks.empty() && chunks.front()->size <= skip){
+                skip -= chunks.front()->size;
+                ring.release(chunks.front());
+                chunks.pop_front();
+            }
+            if(!chunks.empty()){
+                Chunk* chunk = chunks.front();
+                std::memmove(chunk->data, chunk->data + skip, chunk->size - skip);
+                chunk->size -= skip;
+                //continues the recording seamlessly
+                chunk->discontinuity = chunk->discontinuity && tail_length == 0;
+            }
+        }
+        switching = false;
+        for(auto chunk: chunks){
+            record(chunk, recorded);
+        }
+        chunks.clear();
+    }
+
+public:
+    Merger(ChunkRing& ring, size_t links, std::chrono::milliseconds stall):
+        ring(ring),
+        backlog(std::max<size_t>(ring.capacity() / (2 * links), 1)),
+        stall(stall),
+        held(links),
+        last_received(links),
+        active(0),
+        switching(false),
+        waited(0),
+        tail(),
+        tail_length(0)
+    {}
+
+    void take(Chunk* chunk, std::vector<Chunk*>& recorded, const char* name){
+        //appends the chunks to be recorded to `recorded`, in order
+        if(chunk->link == active && !switching){
+            //a reconnect of the active link, another one which received since it broke off
+            //may continue seamlessly
+            if(!chunk->discontinuity || tail_length == 0 || !fail_over(recorded, name)){
+                last_received[chunk->link] = chunk->received;
+                record(chunk, recorded);
+                return;
+            }
+        }
+        last_received[chunk->link] = chunk->received;
+        hold(chunk);
+        if(chunk->link == active && switching){
+            ++waited;
+            align(recorded, name);
+        }
+    }
+
+    void check(std::chrono::system_clock::time_point now, std::vector<Chunk*>& recorded, const char* name){
+        //a stalled active link is replaced by one which still receives
+        if(now - last_received[active] > stall){
+            fail_over(recorded, name);
+        }
+    }
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+template <typename T>
+class TimerWheel {
+    //hierarchical timing wheel with a resolution of a second: six levels of 64 slots. A timer is
+    //kept on the level of the highest group of 6 bits in which its tick differs from the current
+    //one and moves down as time advances. Inserting and cancelling take constant time, occupied
+    //slots are found through one bitmap per level
+public:
+    typedef uint64_t Handle; //generation and index of the node
+    static const Handle invalid = ~Handle(0); //never refers to a timer
+
+private:
+    static const int levels = 6;
+    static const int bits = 6;
+    static const uint32_t slots = 1u << bits;
+    static const uint32_t expired = levels * slots; //list of the timers which are due
+    static const uint32_t nil = ~uint32_t(0);
+
+    struct Node {
+        T value;
+        uint64_t tick;
+        uint32_t prev;
+        uint32_t next;
+        uint32_t list;
+        uint32_t generation;
+    };
+    std::vector<Node> nodes;
+    uint32_t unused; //singly linked through `next`
+    uint32_t heads[levels * slots + 1];
+    uint64_t occupied[levels];
+    uint64_t now;
+    size_t count;
+
+    void link(uint32_t index){
+        Node& node = nodes[index];
+        uint64_t differing = node.tick ^ now;
+        if(node.tick <= now){
+            node.list = expired;
+        }
+        else {
+            int level = 0;
+            while(level < levels - 1 && (differing >> (bits * (level + 1))) != 0){
+                ++level;
+            }
+            uint32_t slot = (node.tick >> (bits * level)) & (slots - 1);
+            node.list = level * slots + slot;
+            occupied[level] |= uint64_t(1) << slot;
+        }
+        node.prev = nil;
+        node.next = heads[node.list];
+        if(node.next != nil){
+            nodes[node.next].prev = index;
+        }
+        heads[node.list] = index;
+    }
+
+    void unlink(uint32_t index){
+        Node& node = nodes[index];
+        if(node.prev != nil){
+            nodes[node.prev].next = node.next;
+        }
+        else {
+            heads[node.list] = node.next;
+            if(node.next == nil && node.list != expired){
+                occupied[node.list / slots] &= ~(uint64_t(1) << (node.list % slots));
+            }
+        }
+        if(node.next != nil){
+            nodes[node.next].prev = node.prev;
+        }
+    }
+
+    void release(uint32_t index){
+        Node& node = nodes[index];
+        ++node.generation;
+        node.list = nil;
+        node.next = unused;
+        unused = index;
+        --count;
+    }
+
+public:
+    explicit TimerWheel(uint64_t now):
+        nodes(),
+        unused(nil),
+        heads(),
+        occupied(),
+        now(now),
+        count(0)
+    {
+        std::fill(std::begin(heads), std::end(heads), nil);
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    Handle insert(uint64_t tick, const T& value){
+        uint32_t index = unused;
+        if(index != nil){
+            unused = nodes[index].next;
+            nodes[index].value = value;
+        }
+        else {
+            index = nodes.size();
+            nodes.push_back(Node{value, 0, nil, nil, nil, 0});
+        }
+        nodes[index].tick = tick;
+        link(index);
+        ++count;
+        return (uint64_t(nodes[index].generation) << 32) | index;
+    }
+
+    bool cancel(Handle handle){
+        //false if the timer is due or cancelled already
+        uint32_t index = handle & 0xFFFFFFFFu;
+        if(index >= nodes.size() || nodes[index].generation != (handle >> 32) || nodes[index].list == nil){
+            return false;
+        }
+        unlink(index);
+        release(index);
+        return true;
+    }
+
+    uint64_t next() const {
+        //a tick not after the earliest timer, the maximum if there is none
+        if(heads[expired] != nil){
+            return now;
+        }
+        for(int level = 0; level < levels; ++level){
+            uint32_t current = (now >> (bits * level)) & (slots - 1);
+            uint64_t later = current == slots - 1 ? 0 : occupied[level] & (~uint64_t(0) << (current + 1));
+            if(later != 0){
+                uint64_t slot = __builtin_ctzll(later);
+                int shift = bits * (level + 1);
+                uint64_t group = shift < 64 ? (now >> shift) << shift : 0;
+                return group | (slot << (bits * level));
+            }
+        }
+        return ~uint64_t(0);
+    }
+
+    void advance(uint64_t to, std::vector<T>& due){
+        //moves time forward, appending the values of the timers which are due to `due`
+        if(to > now){
+            uint64_t from = now;
+            now = to;
+            //from the top, timers of the slots passed move down or expire
+            for(int level = levels - 1; level >= 0; --level){
+                int shift = bits * level;
+                uint32_t first = (from >> shift) & (slots - 1);
+                uint32_t last = (to >> shift) & (slots - 1);
+                bool wrapped = bits * (level + 1) < 64 && (from >> (bits * (level + 1))) != (to >> (bits * (level + 1)));
+                uint64_t passed = wrapped ? ~uint64_t(0) : (first == last ? 0 : (~uint64_t(0) << (first + 1)) & (last == slots - 1 ? ~uint64_t(0) : ~(~uint64_t(0) << (last + 1))));
+                for(uint64_t pending = occupied[level] & passed; pending != 0; pending &= pending - 1){
+                    uint32_t list = level * slots + __builtin_ctzll(pending);
+                    uint32_t index = heads[list];
+                    heads[list] = nil;
+                    occupied[level] &= ~(uint64_t(1) << (list % slots));
+                    while(index != nil){
+                        uint32_t next = nodes[index].next;
+                        link(index);
+                        index = next;
+                    }
+                }
+            }
+        }
+
+        for(uint32_t index = heads[expired]; index != nil; ){
+            uint32_t next = nodes[index].next;
+            due.push_back(std::move(nodes[index].value));
+            release(index);
+            index = next;
+        }
+        heads[expired] = nil;
+    }
+};
+
+template <typename T>
+const typename TimerWheel<T>::Handle TimerWheel<T>::invalid;
+template <typename T>
+const uint32_t TimerWheel<T>::nil;